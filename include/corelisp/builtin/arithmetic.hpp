@@ -3,85 +3,114 @@
 
 
 #include <iterator>
-#include <numeric>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
-#include <boost/lexical_cast.hpp>
-
-#include <corelisp/lisp/evaluator.hpp>
 #include <corelisp/lisp/vectored_cons_cells.hpp>
 
 
 namespace builtin
 {
-  template <typename T>
-  using add_const_lvalue_reference
-    = typename std::add_const<typename std::add_lvalue_reference<T>::type>;
-
-
-  // XXX 全体的に雑すぎる
+  // 引数は機械表現のまま T として取り出し、結果も T のままセルに格納する。
+  // T が詰めたベクトルの場合、演算と比較は要素毎に行われる
   template <typename T, template <typename...> typename BinaryOperator
   , typename = typename std::enable_if<
-                          std::is_same<
-                            decltype(
-                              boost::lexical_cast<T>(
-                                std::declval<
-                                  typename add_const_lvalue_reference<
-                                    lisp::vectored_cons_cells::value_type
-                                  >::type
-                                >()
-                              )
-                            ),
-                            T
-                          >::value
-                        >::type
-  , typename = typename std::enable_if<
-                          std::is_same< // TODO なんか気に入らない
-                            decltype(
-                              boost::lexical_cast<
-                                lisp::vectored_cons_cells::value_type
-                              >(std::declval<T>())
-                            ),
-                            lisp::vectored_cons_cells::value_type
+                          std::is_constructible<
+                            lisp::vectored_cons_cells, T
                           >::value
                         >::type>
   class arithmetic
   {
     using cells_type = lisp::vectored_cons_cells;
-    using value_type = typename cells_type::value_type;
-    using scope_type = typename cells_type::scope_type;
 
-    cells_type buffer_;
+    using result_type = decltype(
+                          std::declval<BinaryOperator<T>>()(std::declval<const T&>(), std::declval<const T&>())
+                        );
+
+    static auto operand_(const cells_type& e)
+      -> decltype(auto) // 数値は多倍長の数と所有権を共有する値として、それ以外は参照として
+    {
+      if constexpr (std::is_same<T, lisp::number>::value)
+      {
+        return e.as_number();
+      }
+      else return e.template as<T>();
+    }
 
   public:
-    auto operator()(cells_type& expr, scope_type& scope)
-      -> cells_type&
+    auto operator()(std::vector<cells_type>& operands) const
+      -> cells_type
     {
-      std::vector<T> args {};
+      if (std::empty(operands))
+      {
+        throw std::invalid_argument {"too few arguments"};
+      }
 
-      for (auto iter {std::begin(expr) + 1}; iter != std::end(expr); ++iter)
+      if constexpr (std::is_same<result_type, bool>::value)
       {
-        args.emplace_back(boost::lexical_cast<T>(lisp::evaluate(*iter, scope).value));
+        for (auto iter {std::next(std::begin(operands))}; iter != std::end(operands); ++iter)
+        {
+          if (not BinaryOperator<T> {}(operand_(*std::prev(iter)), operand_(*iter)))
+          {
+            return lisp::false_value;
+          }
+        }
+
+        return lisp::true_value;
       }
+      else
+      {
+        T buffer {operand_(*std::begin(operands))};
 
-      const auto buffer {std::accumulate(
-        std::begin(args) + 1, std::end(args), args.front(), BinaryOperator<T> {}
-      )};
+        for (auto iter {std::next(std::begin(operands))}; iter != std::end(operands); ++iter)
+        {
+          buffer = BinaryOperator<T> {}(buffer, operand_(*iter));
+        }
 
-      // TODO comparison functions を分離
-      if constexpr (std::is_same<typename BinaryOperator<T>::result_type, T>::value)
+        return {std::move(buffer)};
+      }
+    }
+  };
+
+  // 先頭の被演算子の型に応じて arithmetic<T, BinaryOperator> を選ぶ。どれでもなければ最初の型として扱う
+  template <template <typename...> typename BinaryOperator, typename T, typename... Ts>
+  class overloaded_arithmetic
+  {
+    using cells_type = lisp::vectored_cons_cells;
+
+    template <typename U>
+    static bool holds_(const cells_type& e) noexcept
+    {
+      if constexpr (std::is_same<U, lisp::number>::value)
       {
-        return buffer_ = {boost::lexical_cast<value_type>(buffer)};
+        return e.is_number();
       }
-      else
+      else return e.template get_if<U>();
+    }
+
+  public:
+    auto operator()(std::vector<cells_type>& operands) const
+      -> cells_type
+    {
+      if (std::empty(operands) or holds_<T>(operands.front()))
+      {
+        return arithmetic<T, BinaryOperator> {}(operands);
+      }
+
+      cells_type result {};
+
+      const auto& front {operands.front()};
+
+      if (((holds_<Ts>(front) and (result = arithmetic<Ts, BinaryOperator> {}(operands), true)) or ...))
       {
-        return buffer != 0 ? lisp::true_value : lisp::false_value;
+        return result;
       }
+      else return arithmetic<T, BinaryOperator> {}(operands);
     }
   };
 } // namespace builtin
 
 
 #endif // INCLUDED_CORELISP_BUILTIN_ARITHMETIC_HPP
-
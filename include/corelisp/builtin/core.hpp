@@ -0,0 +1,114 @@
+#ifndef INCLUDED_CORELISP_BUILTIN_CORE_HPP
+#define INCLUDED_CORELISP_BUILTIN_CORE_HPP
+
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <corelisp/builtin/arithmetic.hpp>
+#include <corelisp/builtin/memoize.hpp>
+#include <corelisp/builtin/packed_vector.hpp>
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/collector.hpp>
+#include <corelisp/lisp/evaluator.hpp>
+#include <corelisp/lisp/number.hpp>
+#include <corelisp/lisp/packed_vector.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace builtin
+{
+  // 基本のビルトインをインタプリタ毎の表に登録する。memoize と gc はそのインタプリタの collector を使い、
+  // 他は状態を持たないので、同じ定義を複数のインタプリタに登録しても互いに干渉しない
+  inline void define(lisp::analyzer::primitives_type& primitives, const std::shared_ptr<lisp::collector>& collection)
+  {
+    using namespace lisp;
+
+    primitives["atom"] = [](auto& args)
+      -> vectored_cons_cells
+    {
+      return args.at(0).is_atom() ? true_value : false_value;
+    };
+
+    primitives["eq"] = [](auto& args) // XXX EQって可変長じゃなくても良かったっけ
+      -> vectored_cons_cells
+    {
+      return args.at(0) != args.at(1) ? false_value : true_value;
+    };
+
+    primitives["car"] = [](auto& args)
+      -> vectored_cons_cells
+    {
+      return args.at(0).at(0);
+    };
+
+    primitives["cdr"] = [](auto& args)
+      -> vectored_cons_cells
+    {
+      auto& buffer {args.at(0)};
+      return std::size(buffer) != 0 ? cdr(std::move(buffer)) : false_value;
+    };
+
+    primitives["cons"] = [](auto& args)
+      -> vectored_cons_cells
+    {
+      return cons(std::move(args.at(0)), std::move(args.at(1)));
+    };
+
+    primitives["memoize"] = memoize {collection};
+    primitives["memo-stats"] = memoize::statistics;
+
+    primitives["gc"] = [collection](auto&) // 断ち切った循環の数
+      -> vectored_cons_cells
+    {
+      return vectored_cons_cells {number {static_cast<fixnum>((*collection).collect())}};
+    };
+
+    primitives["f64vector"]      = packed_vector<lisp::flonum> {};
+    primitives["i64vector"]      = packed_vector<lisp::fixnum> {};
+    primitives["make-f64vector"] = packed_vector<lisp::flonum>::make;
+    primitives["make-i64vector"] = packed_vector<lisp::fixnum>::make;
+    primitives["vector-length"]  = vector_length;
+    primitives["vector-ref"]     = vector_ref;
+    primitives["vector-sum"]     = vector_sum;
+    primitives["vector-dot"]     = vector_dot;
+
+    // 数値に加えて詰めたベクトル同士の要素毎の演算も受け付ける
+    using lisp::number, lisp::f64vector, lisp::i64vector;
+    primitives["+"]  = overloaded_arithmetic<std::plus,          number, f64vector, i64vector> {};
+    primitives["-"]  = overloaded_arithmetic<std::minus,         number, f64vector, i64vector> {};
+    primitives["*"]  = overloaded_arithmetic<std::multiplies,    number, f64vector, i64vector> {};
+    primitives["/"]  = [](auto& args) // 整数のベクトルは割り算しない
+      -> vectored_cons_cells
+    {
+      if (not std::empty(args) and args.front().template get_if<i64vector>())
+      {
+        throw std::invalid_argument {"i64vector does not support /"};
+      }
+
+      return overloaded_arithmetic<std::divides, number, f64vector> {}(args);
+    };
+    primitives["="]  = overloaded_arithmetic<std::equal_to,      number, f64vector, i64vector> {};
+    primitives["<"]  = overloaded_arithmetic<std::less,          number, f64vector, i64vector> {};
+    primitives["<="] = overloaded_arithmetic<std::less_equal,    number, f64vector, i64vector> {};
+    primitives[">"]  = overloaded_arithmetic<std::greater,       number, f64vector, i64vector> {};
+    primitives[">="] = overloaded_arithmetic<std::greater_equal, number, f64vector, i64vector> {};
+  }
+
+  // 上に加えて、副作用のないものを最適化で畳み込めるようにする
+  inline void define(lisp::evaluator& evaluate)
+  {
+    define(static_cast<lisp::analyzer::primitives_type&>(evaluate), evaluate.collection());
+
+    for (const auto& each : {"atom", "eq", "car", "cdr", "+", "-", "*", "/", "=", "<", "<=", ">", ">="})
+    {
+      evaluate.optimization().foldable(each);
+    }
+  }
+} // namespace builtin
+
+
+#endif // INCLUDED_CORELISP_BUILTIN_CORE_HPP
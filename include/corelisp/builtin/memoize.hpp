@@ -0,0 +1,324 @@
+#ifndef INCLUDED_CORELISP_BUILTIN_MEMOIZE_HPP
+#define INCLUDED_CORELISP_BUILTIN_MEMOIZE_HPP
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+#include <boost/functional/hash.hpp>
+
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/collector.hpp>
+#include <corelisp/lisp/number.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace builtin
+{
+  // (memoize f [capacity]) は f と同じ引数を取り、評価済みの引数の構造が同じ呼び出しには
+  // 前回の結果を返すクロージャを作る。f は純粋であること。表は capacity 件を超えると
+  // 最も長く使われていないものから捨てる。表はクロージャ自身を含む値を持ちうるので、
+  // 作ったクロージャの procedure::state として持たせて、登録したインタプリタの collector に辿らせる
+  class memoize
+  {
+    using cells_type = lisp::vectored_cons_cells;
+    using arguments_type = typename lisp::analyzer::arguments_type;
+
+    std::shared_ptr<lisp::collector> collector_;
+
+  public:
+    static constexpr std::size_t default_capacity {4096};
+
+    // 作ったクロージャの本体。名前の付いた型にしておき、(memo-stats f) で本体から取り出す
+    class cache
+    {
+    public:
+      struct entry
+      {
+        std::size_t hash;
+        arguments_type arguments;
+        cells_type value;
+      };
+
+      struct state
+        : public lisp::mutable_state
+      {
+        const cells_type function;
+        const std::size_t capacity;
+
+        const std::shared_ptr<lisp::collector> collector; // 表への追加を知らせる
+
+        mutable std::mutex mutex {}; // pcall などで複数のスレッドから呼ばれうる
+
+        std::list<entry> entries {}; // 先頭ほど最近使った
+        std::unordered_multimap<std::size_t, typename std::list<entry>::iterator> index {};
+
+        std::size_t hits {0}, misses {0};
+
+        state(const cells_type& function, std::size_t capacity, const std::shared_ptr<lisp::collector>& collector)
+          : function {function},
+            capacity {capacity},
+            collector {collector}
+        {}
+
+        // ロックを持った状態で呼ぶ
+        auto find(std::size_t hash, const arguments_type& arguments)
+          -> typename std::list<entry>::iterator
+        {
+          for (auto [iter, last] {index.equal_range(hash)}; iter != last; ++iter)
+          {
+            if (const auto& cached {(*iter->second).arguments}; std::size(cached) == std::size(arguments) and std::equal(std::begin(cached), std::end(cached), std::begin(arguments), identical))
+            {
+              return iter->second;
+            }
+          }
+
+          return std::end(entries);
+        }
+
+        void trace(const std::function<void (const cells_type&)>& f) const override
+        {
+          f(function);
+
+          std::lock_guard lock {mutex};
+
+          for (const auto& each : entries)
+          {
+            std::for_each(std::begin(each.arguments), std::end(each.arguments), f);
+            f(each.value);
+          }
+        }
+
+        void clear() override
+        {
+          std::list<entry> released {};
+
+          {
+            std::lock_guard lock {mutex};
+            index.clear();
+            released.swap(entries);
+          }
+
+          // 値を捨てると自身も解放されうるので、ロックを放してから捨てる
+        }
+
+        void wrapper(const std::function<void (const lisp::symbol&, const cells_type&, const cells_type&)>& f) const override
+        {
+          cells_type arguments {};
+          arguments.push_back(cells_type {lisp::number {static_cast<lisp::fixnum>(capacity)}});
+          f(lisp::symbol {"memoize"}, function, arguments);
+        }
+      };
+
+    protected:
+      std::weak_ptr<state> state_; // 所有するのは procedure::state
+
+    public:
+      explicit cache(const std::shared_ptr<state>& table)
+        : state_ {table}
+      {}
+
+      auto operator()(const lisp::environment& env) const
+        -> cells_type
+      {
+        const auto table {lock_()}; // 計算中に表が捨てられないように持っておく
+
+        auto& memo {*table};
+
+        arguments_type arguments ((*env).data(), (*env).data() + (*env).size());
+
+        std::size_t hash {0};
+
+        for (const auto& each : arguments)
+        {
+          boost::hash_combine(hash, each.hash());
+        }
+
+        if (auto cached {find_(memo, hash, arguments)}; cached)
+        {
+          return *cached;
+        }
+
+        // 計算中はロックを持たない（再帰呼び出しが同じ表を引くため）
+        auto value {lisp::analyzer::apply(memo.function, arguments_type {arguments})};
+
+        std::lock_guard lock {memo.mutex};
+
+        ++memo.misses;
+
+        if (memo.find(hash, arguments) != std::end(memo.entries)) // 計算中に他のスレッドが登録した
+        {
+          return value;
+        }
+
+        memo.entries.push_front({hash, std::move(arguments), value});
+        memo.index.emplace(hash, std::begin(memo.entries));
+
+        (*memo.collector).written();
+
+        if (memo.capacity < std::size(memo.entries))
+        {
+          const auto oldest {std::prev(std::end(memo.entries))};
+
+          for (auto [iter, last] {memo.index.equal_range((*oldest).hash)}; iter != last; ++iter)
+          {
+            if (iter->second == oldest)
+            {
+              memo.index.erase(iter);
+              break;
+            }
+          }
+
+          memo.entries.erase(oldest);
+        }
+
+        return value;
+      }
+
+      // (hits misses size)
+      auto statistics() const
+        -> cells_type
+      {
+        const auto memo {lock_()};
+
+        std::lock_guard lock {(*memo).mutex};
+
+        cells_type result {};
+
+        for (const auto& each : {(*memo).hits, (*memo).misses, std::size((*memo).entries)})
+        {
+          result.push_back(cells_type {lisp::number {static_cast<lisp::fixnum>(each)}});
+        }
+
+        return result;
+      }
+
+    protected:
+      auto lock_() const
+        -> std::shared_ptr<state>
+      {
+        if (auto memo {state_.lock()}; memo)
+        {
+          return memo;
+        }
+        else throw std::logic_error {"memoize: the table has been released"};
+      }
+
+      static auto find_(state& memo, std::size_t hash, const arguments_type& arguments)
+        -> std::optional<cells_type>
+      {
+        std::lock_guard lock {memo.mutex};
+
+        if (auto iter {memo.find(hash, arguments)}; iter != std::end(memo.entries))
+        {
+          memo.entries.splice(std::begin(memo.entries), memo.entries, iter);
+          ++memo.hits;
+          return (*iter).value;
+        }
+        else return std::nullopt;
+      }
+    };
+
+    explicit memoize(const std::shared_ptr<lisp::collector>& collector)
+      : collector_ {collector}
+    {}
+
+    auto operator()(arguments_type& args) const
+      -> cells_type
+    {
+      const auto& f {args.at(0)};
+
+      if (not f.closure)
+      {
+        throw std::invalid_argument {"memoize: not a procedure"};
+      }
+
+      auto capacity {default_capacity};
+
+      if (1 < std::size(args))
+      {
+        const auto n {args[1].as_number()};
+
+        if (not std::holds_alternative<lisp::fixnum>(n))
+        {
+          throw std::invalid_argument {"memoize: capacity must be an exact integer"};
+        }
+        else if (0 < std::get<lisp::fixnum>(n))
+        {
+          capacity = std::get<lisp::fixnum>(n);
+        }
+        else throw std::invalid_argument {"memoize: capacity must be positive"};
+      }
+
+      // 表示は元の lambda 式のまま。イメージには state::wrapper で memoize の呼び出しとして保存する
+      const auto memo {std::make_shared<cache::state>(f, capacity, collector_)};
+
+      (*collector_).enroll(memo);
+
+      auto result {f};
+      result.closure = std::make_shared<lisp::procedure>(lisp::procedure {(*f.closure).arity, cache {memo}, (*f.closure).closure, nullptr, (*f.closure).scope, true, memo});
+      return result;
+    }
+
+    // (memo-stats f) は memoize で作ったクロージャなら (hits misses size)、それ以外は false
+    static auto statistics(arguments_type& args)
+      -> cells_type
+    {
+      if (const auto& f {args.at(0)}; f.closure)
+      {
+        if (const auto* memoized {(*f.closure).body.target<cache>()}; memoized)
+        {
+          return (*memoized).statistics();
+        }
+      }
+
+      return lisp::false_value;
+    }
+
+    // 表示まで含めて区別できること。1 と 1.0 で結果が変わる関数もあるので、== ではなくこちらで比べる
+    static bool identical(const cells_type& lhs, const cells_type& rhs)
+    {
+      if (lhs.kind() != rhs.kind())
+      {
+        return false;
+      }
+
+      switch (lhs.kind())
+      {
+      case cells_type::tag::closure:
+        return lhs.closure == rhs.closure;
+
+      case cells_type::tag::pair:
+        return std::size(lhs) == std::size(rhs) and std::equal(std::begin(lhs), std::end(lhs), std::begin(rhs), identical);
+
+      case cells_type::tag::f64vector:
+      case cells_type::tag::i64vector:
+        return *lhs.packed == *rhs.packed;
+
+      case cells_type::tag::bignum:
+      case cells_type::tag::ratnum:
+        return lhs.as_number() == rhs.as_number();
+
+      case cells_type::tag::flonum:
+        return lhs.value == rhs.value and std::signbit(std::get<lisp::flonum>(lhs.as_number())) == std::signbit(std::get<lisp::flonum>(rhs.as_number()));
+
+      default:
+        return lhs.value == rhs.value;
+      }
+    }
+  };
+} // namespace builtin
+
+
+#endif // INCLUDED_CORELISP_BUILTIN_MEMOIZE_HPP
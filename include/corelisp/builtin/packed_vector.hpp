@@ -0,0 +1,141 @@
+#ifndef INCLUDED_CORELISP_BUILTIN_PACKED_VECTOR_HPP
+#define INCLUDED_CORELISP_BUILTIN_PACKED_VECTOR_HPP
+
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include <corelisp/lisp/number.hpp>
+#include <corelisp/lisp/packed_vector.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace builtin
+{
+  // 要素毎の演算と比較は arithmetic<f64vector, ...> などとして登録する。ここにあるのはそれ以外の操作
+  template <typename T>
+  class packed_vector
+  {
+    using cells_type = lisp::vectored_cons_cells;
+    using vector_type = lisp::packed_vector<T>;
+
+    // i64vector には fixnum に収まる正確な整数しか入れられない
+    static auto element_(const cells_type& e)
+      -> T
+    {
+      if constexpr (std::is_floating_point<T>::value)
+      {
+        return e.as_number().inexact();
+      }
+      else if (e.as_number().is_fixnum())
+      {
+        return std::get<lisp::fixnum>(e.as_number());
+      }
+      else throw std::invalid_argument {"not a fixnum"};
+    }
+
+  public:
+    // (f64vector x ...)
+    auto operator()(std::vector<cells_type>& args) const
+      -> cells_type
+    {
+      std::vector<T> buffer {};
+      buffer.reserve(std::size(args));
+
+      for (const auto& each : args)
+      {
+        buffer.push_back(element_(each));
+      }
+
+      return {vector_type {std::begin(buffer), std::end(buffer)}};
+    }
+
+    // (make-f64vector n [fill])
+    static auto make(std::vector<cells_type>& args)
+      -> cells_type
+    {
+      const auto& size {args.at(0).as_number()};
+
+      if (not size.is_fixnum() or std::get<lisp::fixnum>(size) < 0)
+      {
+        throw std::invalid_argument {"not a valid length"};
+      }
+      else if (vector_type::max_size() < static_cast<std::size_t>(std::get<lisp::fixnum>(size)))
+      {
+        throw std::length_error {"too many elements"};
+      }
+
+      return {vector_type {static_cast<std::size_t>(std::get<lisp::fixnum>(size)), 1 < std::size(args) ? element_(args[1]) : T {}}};
+    }
+  };
+
+  // 要素の型によらない操作。どちらのベクトルでもなければ例外を送出する
+  template <typename F>
+  auto visit_packed_vector(const lisp::vectored_cons_cells& e, F&& f)
+  {
+    if (const auto* v {e.get_if<lisp::f64vector>()}; v)
+    {
+      return f(*v);
+    }
+    else if (const auto* v {e.get_if<lisp::i64vector>()}; v)
+    {
+      return f(*v);
+    }
+    else throw std::invalid_argument {"not a packed vector"};
+  }
+
+  // (vector-length v)
+  inline auto vector_length(std::vector<lisp::vectored_cons_cells>& args)
+    -> lisp::vectored_cons_cells
+  {
+    return visit_packed_vector(args.at(0), [](const auto& v)
+    {
+      return lisp::vectored_cons_cells {lisp::number {static_cast<lisp::fixnum>(std::size(v))}};
+    });
+  }
+
+  // (vector-ref v k)
+  inline auto vector_ref(std::vector<lisp::vectored_cons_cells>& args)
+    -> lisp::vectored_cons_cells
+  {
+    const auto& index {args.at(1).as_number()};
+
+    if (not index.is_fixnum() or std::get<lisp::fixnum>(index) < 0)
+    {
+      throw std::invalid_argument {"not a valid index"};
+    }
+
+    return visit_packed_vector(args.at(0), [k = static_cast<std::size_t>(std::get<lisp::fixnum>(index))](const auto& v)
+    {
+      return lisp::vectored_cons_cells {lisp::number {v.at(k)}};
+    });
+  }
+
+  // (vector-sum v)
+  inline auto vector_sum(std::vector<lisp::vectored_cons_cells>& args)
+    -> lisp::vectored_cons_cells
+  {
+    return visit_packed_vector(args.at(0), [](const auto& v)
+    {
+      return lisp::vectored_cons_cells {lisp::number {v.sum()}};
+    });
+  }
+
+  // (vector-dot v w)
+  inline auto vector_dot(std::vector<lisp::vectored_cons_cells>& args)
+    -> lisp::vectored_cons_cells
+  {
+    return visit_packed_vector(args.at(0), [&](const auto& v)
+    {
+      using vector_type = typename std::decay<decltype(v)>::type;
+      return lisp::vectored_cons_cells {lisp::number {dot(v, args.at(1).template as<vector_type>())}};
+    });
+  }
+} // namespace builtin
+
+
+#endif // INCLUDED_CORELISP_BUILTIN_PACKED_VECTOR_HPP
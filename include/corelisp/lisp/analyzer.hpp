@@ -0,0 +1,655 @@
+#ifndef INCLUDED_CORELISP_LISP_ANALYZER_HPP
+#define INCLUDED_CORELISP_LISP_ANALYZER_HPP
+
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+#include <corelisp/lisp/constant_pool.hpp>
+#include <corelisp/lisp/global_environment.hpp>
+#include <corelisp/lisp/inline_cache.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 式を一度だけ解析して実行可能なノードの木に変換する。
+  // 特殊形式とビルトインは解析時に束縛し、変数はレキシカルアドレスに解決しておく
+  class analyzer
+  {
+  public:
+    using cells_type = vectored_cons_cells;
+    using symbol_type = typename cells_type::symbol_type;
+
+    using node_type = typename procedure::node_type;
+
+    using arguments_type = std::vector<cells_type>;
+    using primitive_type = std::function<cells_type (arguments_type&)>;
+
+    using primitives_type = std::unordered_map<symbol_type, primitive_type>;
+    using globals_type = global_environment;
+
+    using scope_type = std::vector<std::vector<symbol_type>>; // 解析時の環境。末尾が最内フレーム
+
+  protected:
+    primitives_type& primitives_;
+    globals_type& globals_;
+    constant_pool& constants_;
+
+    using syntax_type = auto (analyzer::*)(const cells_type&, const scope_type&, bool) -> node_type;
+
+    // 末尾位置の呼び出しはここに呼び出し先と束縛済みフレームを置いて即座に戻り、
+    // 最も近い call のループがそれを引き取って続行する（トランポリン）
+    static inline thread_local struct
+    {
+      std::shared_ptr<const procedure> callee;
+      environment env;
+    } tail_call_ {};
+
+  public:
+    analyzer(primitives_type& primitives, globals_type& globals, constant_pool& constants)
+      : primitives_ {primitives},
+        globals_ {globals},
+        constants_ {constants}
+    {}
+
+    auto operator()(const cells_type& e, const scope_type& scope = {}, bool tail = false)
+      -> node_type
+    {
+      if (e.is_atom())
+      {
+        return e.identifier() ? variable_(e, scope) : constant_(e);
+      }
+      else if (std::empty(e))
+      {
+        return constant_(e);
+      }
+
+      if (const auto& head {e[0]}; head.identifier() and not lookup_(head.identifier(), scope))
+      {
+        if (auto syntax {syntax_(head.identifier())})
+        {
+          return ((*this).*syntax)(e, scope, tail);
+        }
+        else if (auto iter {primitives_.find(head.identifier())}; iter != std::end(primitives_))
+        {
+          return primitive_(iter->second, e, scope);
+        }
+      }
+
+      return application_(e, scope, tail);
+    }
+
+    // 末尾でない呼び出しの入れ子の上限。バイトコード実行系の起動記録の数もこれで抑える。
+    // 木構造評価器ではその前に、スレッドのスタックの残りが stack_margin を切れば同じエラーにする
+    static constexpr std::size_t max_depth {1 << 20};
+    static constexpr std::size_t stack_margin {256 * 1024};
+
+    static void check_depth()
+    {
+      static thread_local const char* limit {nullptr};
+
+      if (not limit) // スタックは下に伸びる
+      {
+        ::pthread_attr_t attributes {};
+        void* address {nullptr};
+        std::size_t size {0};
+
+        if (::pthread_getattr_np(::pthread_self(), &attributes) == 0)
+        {
+          ::pthread_attr_getstack(&attributes, &address, &size);
+          ::pthread_attr_destroy(&attributes);
+        }
+
+        limit = static_cast<const char*>(address) + std::min(size / 4, stack_margin);
+      }
+
+      if (static_cast<const char*>(__builtin_frame_address(0)) < limit)
+      {
+        throw std::runtime_error {"recursion too deep"};
+      }
+    }
+
+    static auto call(std::shared_ptr<const procedure> callee, environment env)
+      -> cells_type
+    {
+      check_depth();
+
+      while (true)
+      {
+        auto result {(*callee).body(env)};
+
+        if (not tail_call_.callee)
+        {
+          return result;
+        }
+
+        callee = std::move(tail_call_.callee);
+        env = std::move(tail_call_.env);
+      }
+    }
+
+    static auto apply(const cells_type& f, arguments_type&& args)
+      -> cells_type
+    {
+      const auto& proc {*f.closure};
+
+      if (std::size(args) != proc.arity)
+      {
+        throw std::invalid_argument {"wrong number of arguments"};
+      }
+
+      auto env {frame::make(proc.closure, proc.arity)};
+      std::move(std::begin(args), std::end(args), (*env).data());
+      return call(f.closure, std::move(env));
+    }
+
+    static void reset() noexcept // 例外で評価が中断された場合用
+    {
+      tail_call_ = {};
+    }
+
+    // (pcall f a b) を (pcall f (lambda () a) (lambda () b)) に書き換える（offset 番目以降の要素を包む）。
+    // 引数式は環境ごとサンクに包んでビルトインの pcall に渡し、そちらで並列に呼び出させる。
+    // (profile e) も同様に (profile (lambda () e)) としてビルトインに計測させる
+    static auto delay_arguments(const cells_type& e, std::size_t offset = 2)
+      -> cells_type
+    {
+      cells_type result {};
+      result.reserve(std::size(e));
+
+      for (std::size_t index {0}; index < offset; ++index)
+      {
+        result.push_back(e.at(index));
+      }
+
+      for (auto iter {std::next(std::begin(e), offset)}; iter != std::end(e); ++iter)
+      {
+        cells_type thunk {};
+        thunk.push_back(cells_type {symbol_type {"lambda"}});
+        thunk.push_back(cells_type {});
+        thunk.push_back(*iter);
+
+        result.push_back(std::move(thunk));
+      }
+
+      return result;
+    }
+
+    // (define-memo name e) を (define name (memoize e)) に書き換える
+    static auto memoize_definition(const cells_type& e)
+      -> cells_type
+    {
+      cells_type memoized {};
+      memoized.push_back(cells_type {symbol_type {"memoize"}});
+      memoized.push_back(e.at(2));
+
+      cells_type result {};
+      result.push_back(cells_type {symbol_type {"define"}});
+      result.push_back(e.at(1));
+      result.push_back(std::move(memoized));
+
+      return result;
+    }
+
+    static auto syntactic(const symbol_type& name)
+      -> bool
+    {
+      return syntax_(name) != nullptr;
+    }
+
+    // lambda 式 e の本体が参照する、scope（外側の局所変数）で束縛された変数の名前
+    static auto free_variables(const cells_type& e, const scope_type& scope)
+      -> std::vector<symbol_type>
+    {
+      std::vector<symbol_type> result {};
+
+      if (3 <= std::size(e))
+      {
+        scope_type local {parameters_(e[1])};
+        free_variables_(e[2], scope, local, result);
+      }
+
+      return result;
+    }
+
+    // クロージャはフレームの連鎖全体ではなく、本体が参照する変数だけを捕捉する。
+    //   - 参照しなければ何も捕捉しない
+    //   - 参照するのが最内のフレームの変数だけなら、複製せずにそのフレームを捕捉する
+    //   - それ以外は参照する値だけを平坦なフレームに複製する。フレームは作った後に書き換えないので、複製しても同じ値を読む
+    // 本体は捕捉したフレームと仮引数のフレームの下で解析する
+    static auto closure_scope(const cells_type& e, const scope_type& scope)
+      -> std::pair<scope_type, std::vector<symbol_type>> // 捕捉したフレームの名前と、複製する変数の名前
+    {
+      auto captured {free_variables(e, scope)};
+
+      if (std::empty(captured))
+      {
+        return {};
+      }
+      else if (std::all_of(std::begin(captured), std::end(captured), [&](const auto& each) { return lookup_(each, scope).depth == 0; }))
+      {
+        return {scope_type {scope.back()}, {}};
+      }
+      else return {scope_type {captured}, captured};
+    }
+
+  protected:
+    static auto parameters_(const cells_type& e)
+      -> std::vector<symbol_type>
+    {
+      std::vector<symbol_type> params {};
+
+      for (const auto& each : e)
+      {
+        params.push_back(each.identifier());
+      }
+
+      return params;
+    }
+
+    // 解析と同じ規則で辿る。quote の中と、本体の中の lambda の仮引数に隠された名前は数えない
+    static void free_variables_(const cells_type& e, const scope_type& scope, scope_type& local, std::vector<symbol_type>& result)
+    {
+      if (e.is_atom())
+      {
+        if (const auto name {e.identifier()}; name and not lookup_(name, local) and lookup_(name, scope) and std::find(std::begin(result), std::end(result), name) == std::end(result))
+        {
+          result.push_back(name);
+        }
+
+        return;
+      }
+
+      std::size_t offset {0};
+
+      if (const auto name {std::empty(e) ? symbol_type {} : e[0].identifier()}; name and not lookup_(name, local) and not lookup_(name, scope) and syntax_(name))
+      {
+        if (name == symbol_type {"quote"})
+        {
+          return;
+        }
+        else if (name == symbol_type {"lambda"})
+        {
+          if (3 <= std::size(e))
+          {
+            local.push_back(parameters_(e[1]));
+            free_variables_(e[2], scope, local, result);
+            local.pop_back();
+          }
+
+          return;
+        }
+        else if (name == symbol_type {"cond"}) // 節は式ではないので、節の要素をそれぞれ辿る
+        {
+          for (auto iter {std::next(std::begin(e))}; iter != std::end(e); ++iter)
+          {
+            for (const auto& each : *iter)
+            {
+              free_variables_(each, scope, local, result);
+            }
+          }
+
+          return;
+        }
+
+        offset = name == symbol_type {"%inline"} ? 3 : name == symbol_type {"define"} or name == symbol_type {"define-memo"} or name == symbol_type {"%lambda"} ? 2 : 1;
+      }
+
+      for (auto iter {std::begin(e)}; iter != std::end(e); ++iter)
+      {
+        if (offset)
+        {
+          --offset;
+        }
+        else free_variables_(*iter, scope, local, result);
+      }
+    }
+
+    struct address
+    {
+      std::size_t depth, index;
+
+      explicit operator bool() const noexcept
+      {
+        return depth != static_cast<std::size_t>(-1);
+      }
+    };
+
+    static auto lookup_(const symbol_type& name, const scope_type& scope) noexcept
+      -> address
+    {
+      for (std::size_t depth {0}; depth < std::size(scope); ++depth)
+      {
+        const auto& params {scope[std::size(scope) - 1 - depth]};
+
+        for (std::size_t index {0}; index < std::size(params); ++index)
+        {
+          if (params[index] == name)
+          {
+            return {depth, index};
+          }
+        }
+      }
+
+      return {static_cast<std::size_t>(-1), 0};
+    }
+
+    static auto syntax_(const symbol_type& name)
+      -> syntax_type
+    {
+      static const std::unordered_map<symbol_type, syntax_type> syntaces
+      {
+        {"quote",  &analyzer::quote_},
+        {"if",     &analyzer::if_},
+        {"cond",   &analyzer::cond_},
+        {"lambda", &analyzer::lambda_},
+        {"define", &analyzer::define_},
+        {"pcall",  &analyzer::pcall_},
+        {"profile", &analyzer::profile_},
+        {"define-memo", &analyzer::define_memo_},
+        {"%inline", &analyzer::inline_},
+        {"%lambda", &analyzer::rewritten_lambda_}
+      };
+
+      auto iter {syntaces.find(name)};
+      return iter != std::end(syntaces) ? iter->second : nullptr;
+    }
+
+    auto analyze_each_(const cells_type& e, const scope_type& scope, std::size_t offset = 1)
+      -> std::vector<node_type>
+    {
+      std::vector<node_type> nodes {};
+
+      for (auto iter {std::next(std::begin(e), offset)}; iter != std::end(e); ++iter)
+      {
+        nodes.push_back((*this)(*iter, scope));
+      }
+
+      return nodes;
+    }
+
+  protected: // nodes
+    auto constant_(const cells_type& e) const
+      -> node_type
+    {
+      return [e](auto&) { return e; };
+    }
+
+    auto variable_(const cells_type& e, const scope_type& scope) const
+      -> node_type
+    {
+      if (const auto address {lookup_(e.identifier(), scope)}; address)
+      {
+        return [address](const environment& env)
+        {
+          return (*env).at(address.depth)[address.index];
+        };
+      }
+      else return [&globals = globals_, name = e.identifier(), cache = inline_cache<globals_type> {}, e](auto&) // 未束縛のシンボルはそれ自身に評価される
+      {
+        const auto* entry {cache.find(globals, name)};
+        return entry ? (*entry).value() : e;
+      };
+    }
+
+    auto primitive_(primitive_type& primitive, const cells_type& e, const scope_type& scope)
+      -> node_type
+    {
+      return [&primitive, args = analyze_each_(e, scope)](const environment& env)
+      {
+        arguments_type values {};
+        values.reserve(std::size(args));
+
+        for (const auto& each : args)
+        {
+          values.push_back(each(env));
+        }
+
+        return primitive(values);
+      };
+    }
+
+    // 引数を評価してクロージャを呼ぶ。末尾位置なら呼び出しをトランポリンに任せる
+    static auto call_(std::shared_ptr<const procedure> proc, const std::vector<node_type>& args, const environment& env, bool tail)
+      -> cells_type
+    {
+      if (std::size(args) != (*proc).arity)
+      {
+        throw std::invalid_argument {"wrong number of arguments"};
+      }
+
+      auto callee {frame::make((*proc).closure, std::size(args))};
+
+      for (std::size_t index {0}; index < std::size(args); ++index)
+      {
+        (*callee)[index] = args[index](env);
+      }
+
+      if (tail)
+      {
+        tail_call_ = {std::move(proc), std::move(callee)};
+        return {};
+      }
+      else return call(std::move(proc), std::move(callee));
+    }
+
+    // 関数の位置がビルトインの名前に評価された場合
+    static auto call_primitive_(primitives_type& primitives, const inline_cache<primitives_type>& cache, const symbol_type& name, const std::vector<node_type>& args, const environment& env)
+      -> cells_type
+    {
+      arguments_type values {};
+      values.reserve(std::size(args));
+
+      for (const auto& each : args)
+      {
+        values.push_back(each(env));
+      }
+
+      if (auto* entry {cache.find(primitives, name)}; entry)
+      {
+        return entry->second(values);
+      }
+      else throw std::invalid_argument {"not applicable"};
+    }
+
+    auto application_(const cells_type& e, const scope_type& scope, bool tail)
+      -> node_type
+    {
+      // 大域変数の関数は値を複製せず、キャッシュした大域環境の要素からクロージャだけを取り出す
+      if (const auto& head {e[0]}; head.identifier() and not lookup_(head.identifier(), scope))
+      {
+        return [&globals = globals_, &primitives = primitives_, name = head.identifier(), args = analyze_each_(e, scope), tail, global = inline_cache<globals_type> {}, primitive = inline_cache<primitives_type> {}](const environment& env)
+          -> cells_type
+        {
+          if (const auto* entry {global.find(globals, name)}; not entry) // 未束縛のシンボルはそれ自身に評価される
+          {
+            return call_primitive_(primitives, primitive, name, args, env);
+          }
+          else if (const auto& value {(*entry).value()}; value.closure)
+          {
+            return call_(value.closure, args, env, tail);
+          }
+          else return call_primitive_(primitives, primitive, value.identifier(), args, env);
+        };
+      }
+
+      return [&primitives = primitives_, f = (*this)(e[0], scope), args = analyze_each_(e, scope), tail, primitive = inline_cache<primitives_type> {}](const environment& env)
+        -> cells_type
+      {
+        const auto proc {f(env)};
+
+        if (proc.closure)
+        {
+          return call_(proc.closure, args, env, tail);
+        }
+        else return call_primitive_(primitives, primitive, proc.identifier(), args, env);
+      };
+    }
+
+  protected: // special forms
+    auto quote_(const cells_type& e, const scope_type&, bool)
+      -> node_type
+    {
+      return constant_(std::size(e) != 2 ? false_value : constants_(e[1]));
+    }
+
+    auto if_(const cells_type& e, const scope_type& scope, bool tail)
+      -> node_type
+    {
+      if (std::size(e) != 4)
+      {
+        return constant_(false_value);
+      }
+
+      return [test = (*this)(e[1], scope), consequent = (*this)(e[2], scope, tail), alternative = (*this)(e[3], scope, tail)](const environment& env)
+      {
+        return test(env) ? consequent(env) : alternative(env);
+      };
+    }
+
+    auto cond_(const cells_type& e, const scope_type& scope, bool tail)
+      -> node_type
+    {
+      std::vector<std::pair<node_type, node_type>> clauses {};
+
+      for (auto iter {std::next(std::begin(e))}; iter != std::end(e); ++iter)
+      {
+        clauses.emplace_back((*this)(iter->at(0), scope), (*this)(iter->at(1), scope, tail));
+      }
+
+      return [clauses](const environment& env)
+      {
+        for (const auto& [test, expression] : clauses)
+        {
+          if (test(env))
+          {
+            return expression(env);
+          }
+        }
+
+        return false_value; // TODO
+      };
+    }
+
+    auto lambda_(const cells_type& e, const scope_type& scope, bool)
+      -> node_type
+    {
+      return closure_(e, e, scope);
+    }
+
+    // optimizer が作る (%lambda source lambda)。lambda を解析し、表示とイメージへの保存には書き換える前の source を使う
+    auto rewritten_lambda_(const cells_type& e, const scope_type& scope, bool)
+      -> node_type
+    {
+      return closure_(e.at(1), e.at(2), scope);
+    }
+
+    auto closure_(const cells_type& source, const cells_type& e, const scope_type& scope)
+      -> node_type
+    {
+      const auto params {parameters_(e.at(1))};
+
+      auto [captured, copied] {closure_scope(e, scope)};
+
+      std::vector<address> captures {};
+
+      for (const auto& each : copied)
+      {
+        captures.push_back(lookup_(each, scope));
+      }
+
+      auto inner {captured};
+      inner.push_back(params);
+
+      const auto shared {not std::empty(captured) and std::empty(captures)};
+
+      // クロージャの値は lambda 式を共有するだけなので、生成や大域変数からの読み出しで式全体を複製しない
+      return [source = std::shared_ptr<const cells_type> {std::make_shared<cells_type>(source)}, arity = std::size(params), body = (*this)(e.at(2), inner, true), enclosing = std::make_shared<const scope_type>(std::move(captured)), captures = std::move(captures), shared](const environment& env)
+      {
+        environment closure {shared ? env : nullptr};
+
+        if (not std::empty(captures))
+        {
+          closure = frame::make(nullptr, std::size(captures));
+
+          for (std::size_t index {0}; index < std::size(captures); ++index)
+          {
+            (*closure)[index] = (*env).at(captures[index].depth)[captures[index].index];
+          }
+        }
+
+        cells_type buffer {source, 0};
+        buffer.closure = std::make_shared<procedure>(procedure {arity, body, std::move(closure), nullptr, enclosing});
+        return buffer;
+      };
+    }
+
+    auto define_(const cells_type& e, const scope_type& scope, bool)
+      -> node_type
+    {
+      if (std::size(e) != 3)
+      {
+        return constant_(false_value);
+      }
+
+      return [&globals = globals_, name = e[1].identifier(), value = (*this)(e[2], scope)](const environment& env)
+      {
+        return globals.insert_or_assign(name, value(env)).value();
+      };
+    }
+
+    auto define_memo_(const cells_type& e, const scope_type& scope, bool tail)
+      -> node_type
+    {
+      return define_(memoize_definition(e), scope, tail);
+    }
+
+    // optimizer が作る (%inline name f expansion call)。name の値がまだ f なら展開を、そうでなければ元の呼び出しを評価する
+    auto inline_(const cells_type& e, const scope_type& scope, bool tail)
+      -> node_type
+    {
+      return [&globals = globals_, name = e.at(1).identifier(), expected = e.at(2).closure, cache = inline_cache<globals_type> {}, expansion = (*this)(e.at(3), scope, tail), call = (*this)(e.at(4), scope, tail)](const environment& env)
+      {
+        const auto* entry {cache.find(globals, name)};
+        return entry and (*entry).value().closure == expected ? expansion(env) : call(env);
+      };
+    }
+
+    auto pcall_(const cells_type& e, const scope_type& scope, bool)
+      -> node_type
+    {
+      return delayed_(e, scope, 2);
+    }
+
+    auto profile_(const cells_type& e, const scope_type& scope, bool)
+      -> node_type
+    {
+      return delayed_(e, scope, 1);
+    }
+
+    // 同名のビルトインは evaluator が登録する
+    auto delayed_(const cells_type& e, const scope_type& scope, std::size_t offset)
+      -> node_type
+    {
+      if (auto iter {primitives_.find(e[0].identifier())}; iter != std::end(primitives_))
+      {
+        return primitive_(iter->second, delay_arguments(e, offset), scope);
+      }
+      else throw std::invalid_argument {e[0].identifier().name() + " is not available"};
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_ANALYZER_HPP
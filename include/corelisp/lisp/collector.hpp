@@ -0,0 +1,249 @@
+#ifndef INCLUDED_CORELISP_LISP_COLLECTOR_HPP
+#define INCLUDED_CORELISP_LISP_COLLECTOR_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 参照カウントでは解放されない循環を見つけて断ち切る（trial deletion）。
+  // 登録された mutable_state から、クロージャ、フレーム、共有されたリストの残りを辿って
+  // 辿った中での参照の数を数える。参照カウントがそれより大きいものは外（大域環境、評価中のスタック、
+  // 埋め込み側が持つ値、辿れない関数本体など）から参照されているので、そこから辿れるものは生きている。
+  // 生きていない状態を clear すれば循環が切れ、残りは参照カウントで解放される。
+  // 根を列挙しないので評価中に呼んでもよく、判断を誤っても捨てるのは memoize の表などの
+  // 作り直せる状態だけで、評価の結果は変わらない。
+  // 辿る間に他のスレッドが表を書き換えても解放されないよう、辿ったものは回収を終えるまで所有しておく。
+  // 登録簿はインタプリタ毎に一つ持つ
+  class collector
+  {
+  public:
+    static constexpr std::size_t interval {4096}; // 回収の間に挟む書き換えの最小数
+
+  protected:
+    using object_type = std::variant<std::shared_ptr<const mutable_state>, std::shared_ptr<const procedure>, boost::intrusive_ptr<const frame>, std::shared_ptr<const vectored_cons_cells>>;
+
+    struct node
+    {
+      object_type object;
+      std::size_t references, internal {0}; // references は所有する前に読んだ参照カウント
+      bool live {false};
+      std::vector<const void*> edges {};
+    };
+
+    std::mutex mutex_ {};
+
+    std::vector<std::weak_ptr<mutable_state>> states_ {};
+
+    std::atomic<std::size_t> writes_ {0};
+    std::atomic<std::size_t> threshold_ {interval}; // 前回辿った数に比例させ、回収の手間を書き換えの数で均す
+
+  public:
+    collector() = default;
+
+    collector(const collector&) = delete;
+    auto operator=(const collector&) -> collector& = delete;
+
+    void enroll(const std::shared_ptr<mutable_state>& state)
+    {
+      {
+        std::lock_guard lock {mutex_};
+        states_.push_back(state);
+      }
+
+      written();
+      poll();
+    }
+
+    // 登録した状態に値を加えたら呼ぶ。状態のロックを持ったまま呼んでよいよう、回収はしない
+    void written(std::size_t n = 1) noexcept
+    {
+      writes_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 前回の回収から十分に書き換えがあれば回収する
+    void poll()
+    {
+      if (threshold_.load(std::memory_order_relaxed) <= writes_.load(std::memory_order_relaxed))
+      {
+        collect();
+      }
+    }
+
+    // 断ち切った状態の数を返す
+    auto collect()
+      -> std::size_t
+    {
+      std::lock_guard lock {mutex_};
+
+      writes_.store(0, std::memory_order_relaxed);
+
+      std::vector<std::shared_ptr<mutable_state>> candidates {};
+
+      states_.erase(std::remove_if(std::begin(states_), std::end(states_), [&](const auto& each)
+      {
+        if (auto state {each.lock()}; state)
+        {
+          candidates.push_back(std::move(state));
+          return false;
+        }
+        else return true;
+      }), std::end(states_));
+
+      std::unordered_map<const void*, node> nodes {};
+
+      std::vector<const void*> stack {};
+
+      for (const auto& each : candidates) // ここで持っている分を除く。所有する前に数える
+      {
+        const auto references {static_cast<std::size_t>(each.use_count()) - 1};
+        nodes.emplace(each.get(), node {std::shared_ptr<const mutable_state> {each}, references});
+        stack.push_back(each.get());
+      }
+
+      const void* source {nullptr};
+
+      // owner は辿っている値の中の所有者。参照カウントを読んでから複製して所有する。
+      // 状態の trace の中では状態のロックが値を守っている
+      const auto edge = [&](const auto& owner, std::size_t references)
+      {
+        const void* key {owner.get()};
+
+        auto [iter, inserted] {nodes.try_emplace(key, node {object_type {}, references})};
+
+        if (inserted)
+        {
+          iter->second.object = owner;
+          stack.push_back(key);
+        }
+
+        ++iter->second.internal;
+        nodes.at(source).edges.push_back(key);
+      };
+
+      const auto cells = [&](const vectored_cons_cells& e)
+      {
+        std::vector<const vectored_cons_cells*> rest {&e}; // 深く入れ子になったリストでスタックを使い切らないように
+
+        while (not std::empty(rest))
+        {
+          const auto& each {*rest.back()};
+          rest.pop_back();
+
+          if (each.closure)
+          {
+            edge(each.closure, each.closure.use_count());
+          }
+
+          if (each.shared())
+          {
+            edge(each.shared(), each.shared().use_count());
+          }
+
+          for (const auto& element : each.owned())
+          {
+            rest.push_back(&element);
+          }
+        }
+      };
+
+      while (not std::empty(stack)) // 辿った中での参照を数える
+      {
+        source = stack.back();
+        stack.pop_back();
+
+        const auto object {nodes.at(source).object}; // nodes への挿入で要素が移っても持っておく
+
+        std::visit([&](const auto& object)
+        {
+          using type = std::decay_t<decltype(*object)>;
+
+          if constexpr (std::is_same_v<type, mutable_state>)
+          {
+            (*object).trace(cells);
+          }
+          else if constexpr (std::is_same_v<type, procedure>)
+          {
+            if ((*object).closure)
+            {
+              edge((*object).closure, (*(*object).closure).use_count());
+            }
+
+            if ((*object).state)
+            {
+              edge((*object).state, (*object).state.use_count());
+            }
+          }
+          else if constexpr (std::is_same_v<type, frame>)
+          {
+            if ((*object).parent)
+            {
+              edge((*object).parent, (*(*object).parent).use_count());
+            }
+
+            for (std::size_t index {0}; index < (*object).size(); ++index)
+            {
+              cells(const_cast<frame&>(*object)[index]);
+            }
+          }
+          else
+          {
+            cells(*object);
+          }
+        }, object);
+      }
+
+      for (const auto& [key, each] : nodes) // 外から参照されているものから辿れるものは生きている
+      {
+        if (each.internal < each.references)
+        {
+          stack.push_back(key);
+        }
+      }
+
+      while (not std::empty(stack))
+      {
+        auto& each {nodes.at(stack.back())};
+        stack.pop_back();
+
+        if (not std::exchange(each.live, true))
+        {
+          stack.insert(std::end(stack), std::begin(each.edges), std::end(each.edges));
+        }
+      }
+
+      std::size_t count {0};
+
+      for (const auto& each : candidates)
+      {
+        if (not nodes.at(each.get()).live)
+        {
+          (*each).clear();
+          ++count;
+        }
+      }
+
+      threshold_.store(std::max(interval, std::size(nodes)), std::memory_order_relaxed);
+
+      return count;
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_COLLECTOR_HPP
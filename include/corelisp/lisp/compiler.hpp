@@ -0,0 +1,402 @@
+#ifndef INCLUDED_CORELISP_LISP_COMPILER_HPP
+#define INCLUDED_CORELISP_LISP_COMPILER_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/constant_pool.hpp>
+#include <corelisp/lisp/inline_cache.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // オペランドと同じ幅で命令列に並べる。括弧内はオペランド
+  enum class instruction : std::uint32_t
+  {
+    constant,    // (k) constants[k] を積む
+    load_local,  // (depth, index)
+    load_global, // (k) globals[k] のシンボルを大域環境から引く
+    define,      // (k)
+    closure,     // (k) functions[k] と、捕捉する変数（analyzer::closure_scope）からクロージャを作る
+    branch,      // (target) 偽なら target へ
+    jump,        // (target)
+    guard,       // (k, c, target) globals[k] の値が constants[c] のクロージャでなければ target へ
+    call,        // (n, c) 関数と n 個の引数を消費する。関数がビルトインの名前なら callees[c] で引く
+    tail_call,   // (n, c)
+    primitive,   // (k, n) primitives[k] を直接呼ぶ
+    add, subtract, multiply, divide, // (k) 二項の数値演算。数値以外なら primitives[k] に任せる
+    equal, less, less_equal, greater, greater_equal,
+    return_
+  };
+
+  struct bytecode
+  {
+    using word_type = std::underlying_type<instruction>::type;
+
+    std::size_t arity;
+    std::shared_ptr<const vectored_cons_cells> source; // クロージャの表示用の lambda 式
+
+    std::vector<word_type> code;
+    std::vector<vectored_cons_cells> constants;
+    std::vector<std::shared_ptr<const bytecode>> functions;
+    std::vector<const analyzer::primitive_type*> primitives;
+
+    std::shared_ptr<const analyzer::scope_type> scope; // 捕捉した変数の名前
+
+    std::vector<std::pair<std::size_t, std::size_t>> captures {}; // 複製する変数の、外側のフレームでの位置（空なら外側のフレームを共有する）
+
+    struct global_reference
+    {
+      vectored_cons_cells name;
+      inline_cache<analyzer::globals_type> cache {};
+    };
+
+    // 参照箇所毎のキャッシュ。実行中に書き換わる
+    std::vector<global_reference> globals {};
+    std::vector<inline_cache<analyzer::primitives_type>> callees {};
+  };
+
+  // 式をバイトコードに変換する。束縛の解決規則は analyzer と同じ
+  class compiler
+  {
+  public:
+    using cells_type = vectored_cons_cells;
+    using symbol_type = typename cells_type::symbol_type;
+    using word_type = typename bytecode::word_type;
+
+    using primitives_type = typename analyzer::primitives_type;
+    using scope_type = typename analyzer::scope_type;
+
+  protected:
+    primitives_type& primitives_;
+    constant_pool& constants_;
+
+    using syntax_type = void (compiler::*)(const cells_type&, const scope_type&, bool, bytecode&);
+
+  public:
+    compiler(primitives_type& primitives, constant_pool& constants)
+      : primitives_ {primitives},
+        constants_ {constants}
+    {}
+
+    // scope を与えた場合、結果は対応する深さのフレームの下で実行しなければならない
+    auto operator()(const cells_type& e, const scope_type& scope = {})
+      -> std::shared_ptr<const bytecode>
+    {
+      auto result {std::make_shared<bytecode>(bytecode {0, std::make_shared<cells_type>(e), {}, {}, {}, {}, nullptr})};
+      compile_(e, scope, false, *result);
+      emit_(*result, instruction::return_);
+      return result;
+    }
+
+  protected:
+    static void emit_(bytecode& out, instruction i)
+    {
+      out.code.push_back(static_cast<word_type>(i));
+    }
+
+    template <typename... Ts>
+    static void emit_(bytecode& out, instruction i, Ts&&... operands)
+    {
+      emit_(out, i);
+      (out.code.push_back(static_cast<word_type>(operands)), ...);
+    }
+
+    static auto constant_(bytecode& out, const cells_type& e)
+      -> std::size_t
+    {
+      out.constants.push_back(e);
+      return std::size(out.constants) - 1;
+    }
+
+    static auto primitive_(bytecode& out, const analyzer::primitive_type& primitive)
+      -> std::size_t
+    {
+      out.primitives.push_back(&primitive);
+      return std::size(out.primitives) - 1;
+    }
+
+    static auto global_(bytecode& out, const cells_type& e)
+      -> std::size_t
+    {
+      out.globals.push_back({e});
+      return std::size(out.globals) - 1;
+    }
+
+    static auto callee_(bytecode& out)
+      -> std::size_t
+    {
+      out.callees.emplace_back();
+      return std::size(out.callees) - 1;
+    }
+
+    static auto lookup_(const symbol_type& name, const scope_type& scope) noexcept
+      -> std::pair<std::size_t, std::size_t>
+    {
+      for (std::size_t depth {0}; depth < std::size(scope); ++depth)
+      {
+        const auto& params {scope[std::size(scope) - 1 - depth]};
+
+        for (std::size_t index {0}; index < std::size(params); ++index)
+        {
+          if (params[index] == name)
+          {
+            return {depth, index};
+          }
+        }
+      }
+
+      return {static_cast<std::size_t>(-1), 0};
+    }
+
+    static auto syntax_(const symbol_type& name)
+      -> syntax_type
+    {
+      static const std::unordered_map<symbol_type, syntax_type> syntaces
+      {
+        {"quote",  &compiler::quote_},
+        {"if",     &compiler::if_},
+        {"cond",   &compiler::cond_},
+        {"lambda", &compiler::lambda_},
+        {"define", &compiler::define_},
+        {"pcall",  &compiler::pcall_},
+        {"profile", &compiler::profile_},
+        {"define-memo", &compiler::define_memo_},
+        {"%inline", &compiler::inline_},
+        {"%lambda", &compiler::rewritten_lambda_}
+      };
+
+      auto iter {syntaces.find(name)};
+      return iter != std::end(syntaces) ? iter->second : nullptr;
+    }
+
+    static auto operator_(const symbol_type& name)
+      -> instruction
+    {
+      static const std::unordered_map<symbol_type, instruction> operators
+      {
+        {"+",  instruction::add},
+        {"-",  instruction::subtract},
+        {"*",  instruction::multiply},
+        {"/",  instruction::divide},
+        {"=",  instruction::equal},
+        {"<",  instruction::less},
+        {"<=", instruction::less_equal},
+        {">",  instruction::greater},
+        {">=", instruction::greater_equal}
+      };
+
+      auto iter {operators.find(name)};
+      return iter != std::end(operators) ? iter->second : instruction::primitive;
+    }
+
+    void compile_(const cells_type& e, const scope_type& scope, bool tail, bytecode& out)
+    {
+      if (e.is_atom() and e.identifier())
+      {
+        if (const auto [depth, index] {lookup_(e.identifier(), scope)}; depth != static_cast<std::size_t>(-1))
+        {
+          emit_(out, instruction::load_local, depth, index);
+        }
+        else emit_(out, instruction::load_global, global_(out, e));
+
+        return;
+      }
+      else if (e.is_atom() or std::empty(e))
+      {
+        return emit_(out, instruction::constant, constant_(out, e));
+      }
+
+      if (const auto name {e[0].identifier()}; name and lookup_(name, scope).first == static_cast<std::size_t>(-1))
+      {
+        if (auto syntax {syntax_(name)})
+        {
+          return ((*this).*syntax)(e, scope, tail, out);
+        }
+        else if (auto iter {primitives_.find(name)}; iter != std::end(primitives_))
+        {
+          for (auto each {std::next(std::begin(e))}; each != std::end(e); ++each)
+          {
+            compile_(*each, scope, false, out);
+          }
+
+          if (const auto i {operator_(name)}; i != instruction::primitive and std::size(e) == 3)
+          {
+            return emit_(out, i, primitive_(out, iter->second));
+          }
+          else return emit_(out, instruction::primitive, primitive_(out, iter->second), std::size(e) - 1);
+        }
+      }
+
+      for (const auto& each : e)
+      {
+        compile_(each, scope, false, out);
+      }
+
+      emit_(out, tail ? instruction::tail_call : instruction::call, std::size(e) - 1, callee_(out));
+    }
+
+  protected: // special forms
+    void quote_(const cells_type& e, const scope_type&, bool, bytecode& out)
+    {
+      emit_(out, instruction::constant, constant_(out, std::size(e) != 2 ? false_value : constants_(e[1])));
+    }
+
+    void if_(const cells_type& e, const scope_type& scope, bool tail, bytecode& out)
+    {
+      if (std::size(e) != 4)
+      {
+        return emit_(out, instruction::constant, constant_(out, false_value));
+      }
+
+      compile_(e[1], scope, false, out);
+      emit_(out, instruction::branch, 0);
+      const auto alternative {std::size(out.code) - 1};
+
+      compile_(e[2], scope, tail, out);
+      emit_(out, instruction::jump, 0);
+      const auto end {std::size(out.code) - 1};
+
+      out.code[alternative] = std::size(out.code);
+      compile_(e[3], scope, tail, out);
+      out.code[end] = std::size(out.code);
+    }
+
+    void cond_(const cells_type& e, const scope_type& scope, bool tail, bytecode& out)
+    {
+      std::vector<std::size_t> ends {};
+
+      for (auto iter {std::next(std::begin(e))}; iter != std::end(e); ++iter)
+      {
+        compile_(iter->at(0), scope, false, out);
+        emit_(out, instruction::branch, 0);
+        const auto next {std::size(out.code) - 1};
+
+        compile_(iter->at(1), scope, tail, out);
+        emit_(out, instruction::jump, 0);
+        ends.push_back(std::size(out.code) - 1);
+
+        out.code[next] = std::size(out.code);
+      }
+
+      emit_(out, instruction::constant, constant_(out, false_value)); // TODO
+
+      for (const auto& each : ends)
+      {
+        out.code[each] = std::size(out.code);
+      }
+    }
+
+    void lambda_(const cells_type& e, const scope_type& scope, bool, bytecode& out)
+    {
+      closure_(e, e, scope, out);
+    }
+
+    // (%lambda source lambda)。表示用には source を持たせる
+    void rewritten_lambda_(const cells_type& e, const scope_type& scope, bool, bytecode& out)
+    {
+      closure_(e.at(1), e.at(2), scope, out);
+    }
+
+    // 捕捉の規則は analyzer と同じ
+    void closure_(const cells_type& source, const cells_type& e, const scope_type& scope, bytecode& out)
+    {
+      std::vector<symbol_type> params {};
+
+      for (const auto& each : e.at(1))
+      {
+        params.push_back(each.identifier());
+      }
+
+      auto [captured, copied] {analyzer::closure_scope(e, scope)};
+
+      auto function {std::make_shared<bytecode>(bytecode {std::size(params), std::make_shared<cells_type>(source), {}, {}, {}, {}, std::make_shared<const scope_type>(std::move(captured))})};
+
+      for (const auto& each : copied)
+      {
+        (*function).captures.push_back(lookup_(each, scope));
+      }
+
+      auto inner {*(*function).scope};
+      inner.push_back(params);
+
+      compile_(e.at(2), inner, true, *function);
+      emit_(*function, instruction::return_);
+
+      out.functions.push_back(std::move(function));
+      emit_(out, instruction::closure, std::size(out.functions) - 1);
+    }
+
+    void define_(const cells_type& e, const scope_type& scope, bool, bytecode& out)
+    {
+      if (std::size(e) != 3)
+      {
+        return emit_(out, instruction::constant, constant_(out, false_value));
+      }
+
+      compile_(e[2], scope, false, out);
+      emit_(out, instruction::define, constant_(out, e[1]));
+    }
+
+    void define_memo_(const cells_type& e, const scope_type& scope, bool tail, bytecode& out)
+    {
+      define_(analyzer::memoize_definition(e), scope, tail, out);
+    }
+
+    void inline_(const cells_type& e, const scope_type& scope, bool tail, bytecode& out)
+    {
+      emit_(out, instruction::guard, global_(out, e.at(1)), constant_(out, e.at(2)), 0);
+      const auto call {std::size(out.code) - 1};
+
+      compile_(e.at(3), scope, tail, out);
+      emit_(out, instruction::jump, 0);
+      const auto end {std::size(out.code) - 1};
+
+      out.code[call] = std::size(out.code);
+      compile_(e.at(4), scope, tail, out);
+      out.code[end] = std::size(out.code);
+    }
+
+    void pcall_(const cells_type& e, const scope_type& scope, bool, bytecode& out)
+    {
+      delayed_(e, scope, 2, out);
+    }
+
+    void profile_(const cells_type& e, const scope_type& scope, bool, bytecode& out)
+    {
+      delayed_(e, scope, 1, out);
+    }
+
+    void delayed_(const cells_type& e, const scope_type& scope, std::size_t offset, bytecode& out)
+    {
+      const auto iter {primitives_.find(e[0].identifier())};
+
+      if (iter == std::end(primitives_))
+      {
+        throw std::invalid_argument {e[0].identifier().name() + " is not available"};
+      }
+
+      const auto delayed {analyzer::delay_arguments(e, offset)};
+
+      for (auto each {std::next(std::begin(delayed))}; each != std::end(delayed); ++each)
+      {
+        compile_(*each, scope, false, out);
+      }
+
+      emit_(out, instruction::primitive, primitive_(out, iter->second), std::size(delayed) - 1);
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_COMPILER_HPP
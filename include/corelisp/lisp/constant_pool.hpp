@@ -0,0 +1,109 @@
+#ifndef INCLUDED_CORELISP_LISP_CONSTANT_POOL_HPP
+#define INCLUDED_CORELISP_LISP_CONSTANT_POOL_HPP
+
+
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // quote された定数の構造を共有する表（ハッシュコンシング）。
+  // 部分構造から順に登録するので、同じ構造は一つの不変なリストにまとまり、
+  // 登録済みのリスト同士は指している先の比較だけで eq が決まる
+  class constant_pool
+  {
+    using cells_type = vectored_cons_cells;
+
+    std::unordered_multimap<std::size_t, std::shared_ptr<const cells_type>> nodes_;
+
+  public:
+    // e と等しく、登録済みのリストの全体を共有する値を返す。アトムと空リストはそのまま返す
+    auto operator()(const cells_type& e)
+      -> cells_type
+    {
+      if (std::empty(e) or e.closure)
+      {
+        return e;
+      }
+
+      cells_type node {};
+      node.reserve(std::size(e));
+
+      for (const auto& each : e)
+      {
+        node.push_back((*this)(each));
+      }
+
+      const auto hash {node.hash()};
+
+      for (auto [iter, last] {nodes_.equal_range(hash)}; iter != last; ++iter)
+      {
+        if (same_(*iter->second, node))
+        {
+          return {iter->second, 0};
+        }
+      }
+
+      auto shared {std::make_shared<cells_type>(std::move(node))};
+      (*shared).hash_ = hash;
+
+      return {nodes_.emplace(hash, std::move(shared))->second, 0};
+    }
+
+    auto size() const noexcept
+    {
+      return std::size(nodes_);
+    }
+
+  protected:
+    // 表示まで含めて区別できないこと。operator== と違い 1 と 1.0、0.0 と -0.0 はまとめない。
+    // 要素は登録済みなので、部分リストは共有先の比較だけで済む
+    static bool same_(const cells_type& lhs, const cells_type& rhs)
+    {
+      if (std::size(lhs) != std::size(rhs))
+      {
+        return false;
+      }
+
+      for (auto l {std::begin(lhs)}, r {std::begin(rhs)}; l != std::end(lhs); ++l, ++r)
+      {
+        if ((*l).kind() != (*r).kind())
+        {
+          return false;
+        }
+        else if (not std::empty(*l))
+        {
+          if ((*l).tail_ != (*r).tail_)
+          {
+            return false;
+          }
+        }
+        else if ((*l).value != (*r).value)
+        {
+          return false;
+        }
+        else if ((*l).packed and *l != *r)
+        {
+          return false;
+        }
+        else if ((*l).kind() == cells_type::tag::flonum and std::signbit(std::get<flonum>((*l).as_number())) != std::signbit(std::get<flonum>((*r).as_number())))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_CONSTANT_POOL_HPP
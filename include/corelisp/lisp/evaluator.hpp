@@ -2,96 +2,414 @@
 #define INCLUDED_CORELISP_LISP_EVALUATOR_HPP
 
 
-#include <functional>
-#include <iterator>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <stdexcept>
-#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
-#include <boost/cstdlib.hpp>
-
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/collector.hpp>
+#include <corelisp/lisp/compiler.hpp>
+#include <corelisp/lisp/constant_pool.hpp>
+#include <corelisp/lisp/image.hpp>
+#include <corelisp/lisp/optimizer.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/profiler.hpp>
 #include <corelisp/lisp/vectored_cons_cells.hpp>
+#include <corelisp/lisp/virtual_machine.hpp>
+#include <corelisp/utility/thread_pool.hpp>
 
 
 namespace lisp
 {
+  // インタプリタ一つ分。大域環境、ビルトインの表（自身）、定数表をそれぞれ個別に持つので、
+  // 複数のインスタンスを別々のスレッドで同時に使える（一つのインスタンスを複数のスレッドで共有はできない）
   class evaluator
-    : public std::unordered_map<
-               typename vectored_cons_cells::value_type,
-               std::function<vectored_cons_cells& (vectored_cons_cells&, vectored_cons_cells::scope_type&)>
-             >
+    : public analyzer::primitives_type
   {
     using cells_type = vectored_cons_cells;
-    using value_type = typename cells_type::value_type;
-    using scope_type = typename cells_type::scope_type;
+    using globals_type = typename analyzer::globals_type;
 
-    static inline scope_type env_
-    {
-      {"true", true_value.share()}, {"false", false_value.share()}
-    };
+    std::shared_ptr<collector> collector_ {std::make_shared<collector>()}; // memoize の表は評価器より長く生きうるので共有する
+
+    globals_type env_ {};
+
+    constant_pool constants_ {};
+
+    analyzer analyze_ {*this, env_, constants_};
+
+    optimizer optimizer_ {*this, env_};
+
+    compiler compile_ {*this, constants_};
+    virtual_machine execute_ {*this, env_};
+
+    utility::thread_pool pool_;
+
+    std::mutex deferred_; // イメージから読んだ関数の遅延解析はワーカーからも起こる
+
+    // 計測中だけビルトインと大域のクロージャを計測付きのものに差し替え、終われば元に戻す
+    profiler profile_ {};
+
+    bool profiling_ {false};
+
+    std::vector<std::pair<symbol, analyzer::primitive_type>> profiled_primitives_ {};
+    std::vector<std::tuple<symbol, cells_type, const procedure*>> profiled_globals_ {}; // 名前、元の値、差し替えた本体
 
   public:
-    decltype(auto) operator()(const value_type& s, scope_type& env = env_)
+    // pcall と pmap は自身のスレッドプールで実行する。大域環境は読み手がロックを取らずに読めるので、並列に評価する式が define してもよい
+    explicit evaluator(std::size_t workers = utility::thread_pool::hardware_workers())
+      : pool_ {workers}
+    {
+      (*this)["pcall"] = [this](auto& args)
+        -> cells_type
+      {
+        if (std::empty(args))
+        {
+          throw std::invalid_argument {"too few arguments"};
+        }
+
+        analyzer::arguments_type values(std::size(args) - 1);
+
+        pool_.parallel_for(std::size(values), [&](std::size_t index)
+        {
+          values[index] = apply_(args[index + 1], {});
+        });
+
+        return apply_(args[0], std::move(values));
+      };
+
+      (*this)["pmap"] = [this](auto& args)
+        -> cells_type
+      {
+        const auto& f {args.at(0)};
+
+        std::vector<cells_type> values (std::begin(args.at(1)), std::end(args.at(1)));
+
+        pool_.parallel_for(std::size(values), [&](std::size_t index)
+        {
+          values[index] = apply_(f, {std::move(values[index])});
+        });
+
+        cells_type result {};
+        result.reserve(std::size(values));
+
+        for (auto& each : values)
+        {
+          result.push_back(std::move(each));
+        }
+
+        return result;
+      };
+
+      // (profile e) は e を計測付きで評価し、名前毎の集計を標準エラー出力に書く。入れ子の場合は評価するだけ
+      (*this)["profile"] = [this](auto& args)
+        -> cells_type
+      {
+        if (profiling_)
+        {
+          return apply_(args.at(0), {});
+        }
+
+        start_profile();
+
+        try
+        {
+          auto result {apply_(args.at(0), {})};
+          stop_profile();
+          profile_.report(std::cerr);
+          return result;
+        }
+        catch (...)
+        {
+          stop_profile();
+          throw;
+        }
+      };
+    }
+
+    // 大域環境を捨てた後に残る循環を断ち切る
+    ~evaluator()
     {
-      return operator()(cells_type {tokenize(s)}, env);
+      env_.clear();
+      (*collector_).collect();
     }
 
-    auto operator()(cells_type&& e, scope_type& env = env_)
-      -> cells_type&
+    // 解析器と実行系が自身への参照を保持するので、コピーもムーブもしない
+    evaluator(const evaluator&) = delete;
+    auto operator=(const evaluator&) -> evaluator& = delete;
+
+    // 木構造評価器を参照実装として残し、バイトコード実行系は実行時に選べるようにする
+    enum class engine_type
     {
-      auto buffer {e};
-      return operator()(buffer, env);
+      analyzer, virtual_machine
+    } engine {engine_type::analyzer};
+
+    // 真なら各トップレベルの式を optimizer で書き換えてから評価する
+    bool optimize {false};
+
+    // 評価中のエラーの報告先。空なら報告しない
+    std::ostream* errors {&std::cerr};
+
+    // 真ならエラーを報告せずに送出する。埋め込み側が自分の形式で返す場合に使う
+    bool rethrow {false};
+
+    // トークンは s 上のビューとして切り出し、構文木は一時的なアリーナ上に構築して評価後にまとめて解放する。
+    // 解析結果が保持する定数はコピー時に既定のリソースへ移るのでアリーナより長生きできる
+    auto operator()(std::string_view s)
+      -> cells_type
+    {
+      std::array<std::byte, 4096> buffer;
+      std::pmr::monotonic_buffer_resource resource {std::data(buffer), std::size(buffer)};
+
+      return operator()(cells_type {token_views {s, &resource}, &resource});
     }
 
-    auto operator()(cells_type& e, scope_type& env = env_)
-      -> cells_type& try
+    auto operator()(const cells_type& e)
+      -> cells_type try
     {
-      if (e.is_atom())
+      env_.reclaim(); // 再定義で外した値が memoize の表などを生かしたままにしないよう、先に解放する
+
+      globals_type::reader reader {}; // ワーカーでの評価はこの区間の中に収まる
+
+      (*collector_).poll(); // memoize の表などを介した循環を、トップレベルの式の合間に断ち切る
+
+      if (profiling_) // 計測中に定義された関数も計測する
       {
-        if (auto iter {env.find(e.value)}; iter != std::end(env))
-        {
-          return *(iter->second);
-        }
-        else return e;
+        instrument_globals_();
       }
-      else
+
+      if (optimize)
       {
-        if (auto iter {find(e.at(0).value)}; iter != std::end(*this))
+        return evaluate_(optimizer_(e));
+      }
+      else return evaluate_(e);
+    }
+    catch (const std::exception& ex)
+    {
+      analyzer::reset();
+
+      if (rethrow)
+      {
+        throw;
+      }
+      else if (errors)
+      {
+        *errors << "(error: " << ex.what() << " in expression \e[31m" << e << "\e[0m) -> " << std::flush;
+      }
+
+      return false_value;
+    }
+
+    // 前置きのライブラリを読み込み終えた大域環境を保存し、以降のプロセスはそれを写像して開始する
+    void save(const std::string& path) const
+    {
+      globals_type::reader reader {};
+      image::save(env_, path);
+    }
+
+    void load(const std::string& path)
+    {
+      globals_type::reader reader {};
+      // イメージには書き換える前の lambda 式が入っているので、optimize なら解析の前に書き換え直す
+      image::load(env_, path, [this](const cells_type& e, const analyzer::scope_type& scope, const environment& env)
+        -> cells_type
+      {
+        if (engine == engine_type::virtual_machine)
+        {
+          return execute_(compile_(optimize ? optimizer_(e, scope) : e, scope), env);
+        }
+
+        // 木構造評価器では本体の解析を最初の呼び出しまで遅らせ、使われない定義の分は起動時間に効かないようにする
+        struct deferred
+        {
+          std::once_flag flag;
+          analyzer::node_type body;
+        };
+
+        auto inner {scope};
+        inner.emplace_back();
+
+        for (const auto& each : e.at(1))
         {
-          return (iter->second)(e, env);
+          inner.back().push_back(each.identifier());
         }
-        else if (auto& proc {(*this)(e[0], env)}; proc.is_atom())
+
+        const auto arity {std::size(inner.back())};
+
+        auto buffer {e};
+        buffer.closure = std::make_shared<procedure>(procedure {arity, [this, body = e.at(2), inner = std::move(inner), state = std::make_shared<deferred>()](const environment& env)
         {
-          return (*this)(*(env.at(proc.value)), env);
+          std::call_once((*state).flag, [&]()
+          {
+            std::lock_guard lock {deferred_};
+            (*state).body = analyze_(optimize ? optimizer_(body, inner) : body, inner, true);
+          });
+
+          return (*state).body(env);
+        }, env, nullptr, std::make_shared<const analyzer::scope_type>(scope)});
+
+        return buffer;
+      }, *this);
+    }
+
+    // memoize などの状態を登録し、循環を断ち切る。builtin::define が渡す
+    auto collection() const noexcept
+      -> const std::shared_ptr<collector>&
+    {
+      return collector_;
+    }
+
+    auto profile() noexcept
+      -> profiler&
+    {
+      return profile_;
+    }
+
+    auto optimization() noexcept
+      -> optimizer&
+    {
+      return optimizer_;
+    }
+
+    // 以前の集計を捨てて計測を始める。ビルトインを呼び出し元の関数の中から差し替えるので、
+    // 評価の途中（pcall の中など）では呼ばないこと
+    void start_profile()
+    {
+      if (profiling_)
+      {
+        return;
+      }
+
+      globals_type::reader reader {};
+
+      profile_.clear();
+
+      // 実行中でありうる、Lisp 側を呼び返すビルトインは差し替えない（時間は呼び出し元に含まれる）
+      const symbol callbacks[] {"profile", "pcall", "pmap"};
+
+      for (auto& [name, primitive] : static_cast<analyzer::primitives_type&>(*this))
+      {
+        if (std::find(std::begin(callbacks), std::end(callbacks), name) != std::end(callbacks))
+        {
+          continue;
         }
-        else
+
+        profiled_primitives_.emplace_back(name, primitive);
+
+        primitive = [&profile = profile_, id = profile_.define(name, profiler::kind_type::builtin), primitive = primitive](auto& args)
         {
-          scope_type scope {proc.closure};
+          profiler::guard guard {profile, id};
+          return primitive(args);
+        };
+      }
 
-          for (std::size_t index {0}; index < std::size(proc.at(1)); ++index)
-          {
-            scope[proc.at(1).at(index).value] = std::make_shared<cells_type>((*this)(e.at(index + 1), env));
-          }
+      instrument_globals_();
 
-          for (const auto& each : env) // XXX shared_ptrをコピーせずに直接構築してる説あり
-          {
-            scope.emplace(each);
-          }
+      execute_.profiling = &profile_;
+      profiling_ = true;
+    }
+
+    void stop_profile()
+    {
+      if (not profiling_)
+      {
+        return;
+      }
+
+      globals_type::reader reader {};
+
+      for (auto& [name, primitive] : profiled_primitives_)
+      {
+        (*this)[name] = std::move(primitive);
+      }
 
-          return (*this)(proc.at(2), scope);
+      for (auto& [name, value, instrumented] : profiled_globals_) // 計測中に再定義されたものはそのまま
+      {
+        if (auto iter {env_.find(name)}; iter != std::end(env_) and (*iter).value().closure.get() == instrumented)
+        {
+          env_.insert_or_assign(name, value);
         }
       }
 
-      std::exit(boost::exit_failure);
+      profiled_primitives_.clear();
+      profiled_globals_.clear();
+
+      execute_.profiling = nullptr;
+      profiling_ = false;
     }
-    catch (const std::exception& ex)
+
+  protected:
+    auto evaluate_(const cells_type& e)
+      -> cells_type
     {
-      std::cerr << "(error: " << ex.what() << " in expression \e[31m" << e << "\e[0m) -> " << std::flush;
-      return false_value;
+      if (engine == engine_type::virtual_machine)
+      {
+        return execute_(compile_(e));
+      }
+      else return analyze_(e)(nullptr);
     }
-  } static evaluate;
+
+    // 大域変数に束縛されたクロージャを、その名前で計測するクロージャに差し替える。
+    // バイトコード同士の呼び出しは本体を経由しないので、実行系は手続きから名前を引く
+    void instrument_globals_()
+    {
+      env_.for_each([this](const auto& name, const auto& value)
+      {
+        if (not value.closure or profile_.defined(value.closure.get()))
+        {
+          return;
+        }
+
+        const auto& proc {*value.closure};
+        const auto id {profile_.define(name, profiler::kind_type::lambda)};
+
+        auto instrumented {std::make_shared<procedure>(procedure {proc.arity, [&profile = profile_, id, body = proc.body](const environment& env)
+        {
+          profiler::guard guard {profile, id};
+          return body(env);
+        }, proc.closure, proc.code, proc.scope, true, proc.state})};
+
+        profile_.define(value.closure.get(), id);
+        profile_.define(instrumented.get(), id);
+
+        profiled_globals_.emplace_back(name, value, instrumented.get());
+
+        auto buffer {value};
+        buffer.closure = std::move(instrumented);
+        env_.insert_or_assign(name, buffer);
+      });
+    }
+
+    // どのスレッドから呼ばれてもよい。例外で抜けた場合はそのスレッドの末尾呼び出しの状態を片付ける
+    auto apply_(const cells_type& f, analyzer::arguments_type&& args)
+      -> cells_type try
+    {
+      if (f.closure)
+      {
+        return analyzer::apply(f, std::move(args));
+      }
+      else if (auto iter {find(f.identifier())}; iter != std::end(*this))
+      {
+        return (iter->second)(args);
+      }
+      else throw std::invalid_argument {"not applicable"};
+    }
+    catch (...)
+    {
+      analyzer::reset();
+      throw;
+    }
+  };
 } // namespace lisp
 
 
 #endif // INCLUDED_CORELISP_LISP_EVALUATOR_HPP
-
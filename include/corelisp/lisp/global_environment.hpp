@@ -0,0 +1,351 @@
+#ifndef INCLUDED_CORELISP_LISP_GLOBAL_ENVIRONMENT_HPP
+#define INCLUDED_CORELISP_LISP_GLOBAL_ENVIRONMENT_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <corelisp/lisp/symbol.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 大域環境。読み手はロックを取らず、書き手（define）は一つずつ新しい版を公開する（RCU）。
+  //   - 名前から束縛への表は永続的な HAMT で、名前の追加は根からの経路だけを複製した版を
+  //     原子的に差し替える。シンボルの ID は重複しないので衝突の処理は要らない
+  //   - 束縛は環境が生きている間移動も削除もされず、値は不変なセルへのポインタの差し替えで更新する。
+  //     参照箇所毎のキャッシュ（inline_cache）は束縛を覚えたまま、再定義後の値を読める
+  //   - 差し替えた古い版と値は、その時点で読んでいた読み手の区間（reader）が全て終わってから解放する
+  //     （エポックによる回収）。評価は全体を一つの区間の中で行う
+  class global_environment
+  {
+  public:
+    using cells_type = vectored_cons_cells;
+    using symbol_type = symbol;
+
+    class binding
+    {
+      friend class global_environment;
+
+      std::atomic<const cells_type*> value_;
+
+    public:
+      const symbol_type first;
+
+      binding(const symbol_type& name, const cells_type* value)
+        : value_ {value},
+          first {name}
+      {}
+
+      ~binding()
+      {
+        delete value_.load(std::memory_order_relaxed);
+      }
+
+      // 区間の中で読むこと。参照は区間の終わりまで有効
+      auto value() const noexcept
+        -> const cells_type&
+      {
+        return *value_.load(std::memory_order_acquire);
+      }
+    };
+
+    using value_type = binding;
+    using iterator = binding*;
+
+    // この区間の間に読んだ版と値は解放されない。入れ子にしてよく、他の環境の区間を兼ねる
+    class reader
+    {
+    public:
+      reader()
+      {
+        if (auto& self {slot_()}; self.depth++ == 0)
+        {
+          (*self.slot).epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+
+          // 後に続く root_ や値の acquire 読みを、エポックの公開より前に追い越させない。
+          // これがないと回収側がこの区間を見落とし、これから辿る版を解放しうる（ストアの後のロード）
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+      }
+
+      ~reader()
+      {
+        if (auto& self {slot_()}; --self.depth == 0)
+        {
+          (*self.slot).epoch.store(idle_, std::memory_order_release);
+        }
+      }
+
+      reader(const reader&) = delete;
+      auto operator=(const reader&) -> reader& = delete;
+    };
+
+  protected:
+    static constexpr std::size_t bits_ {5}; // 節点毎に ID の 5 ビットで 32 に分岐する
+
+    struct node
+    {
+      struct entry
+      {
+        std::shared_ptr<const node> child; // 版の間で共有される
+        binding* leaf;
+      };
+
+      std::uint32_t bitmap {0};
+      std::vector<entry> entries {}; // bitmap の立っているビットの順
+
+      static auto bit(std::size_t key, std::size_t shift) noexcept
+        -> std::uint32_t
+      {
+        return std::uint32_t {1} << (key >> shift & ((1u << bits_) - 1));
+      }
+
+      auto position(std::uint32_t bit) const noexcept
+        -> std::size_t
+      {
+        return __builtin_popcount(bitmap & (bit - 1));
+      }
+    };
+
+    static constexpr std::uint64_t idle_ {std::numeric_limits<std::uint64_t>::max()};
+
+    struct alignas(64) slot_type // 読み手同士で同じキャッシュラインを書かない
+    {
+      std::atomic<std::uint64_t> epoch {idle_};
+      bool used {false};
+    };
+
+    static inline std::atomic<std::uint64_t> epoch_ {0};
+
+    static inline std::mutex slots_mutex_ {};
+    static inline std::deque<slot_type> slots_ {}; // 要素は移動しないので、各スレッドが自分の分を指しておける
+
+    // スレッド毎に一つ借り、スレッドの終わりに返す
+    struct thread_slot_type
+    {
+      slot_type* slot;
+      std::size_t depth {0}; // 入れ子になった区間の数
+
+      thread_slot_type()
+      {
+        std::lock_guard lock {slots_mutex_};
+
+        auto iter {std::find_if(std::begin(slots_), std::end(slots_), [](const auto& each) { return not each.used; })};
+        slot = iter != std::end(slots_) ? &*iter : &slots_.emplace_back();
+        (*slot).used = true;
+      }
+
+      ~thread_slot_type()
+      {
+        std::lock_guard lock {slots_mutex_};
+        (*slot).used = false;
+      }
+    };
+
+    static auto slot_()
+      -> thread_slot_type&
+    {
+      static thread_local thread_slot_type self {};
+      return self;
+    }
+
+    std::atomic<const node*> root_ {nullptr};
+
+    std::mutex writer_ {}; // 書き手同士だけを直列化する
+
+    std::shared_ptr<const node> current_ {}; // 公開中の版の所有者
+    std::deque<binding> bindings_ {};
+
+    // 差し替えた時点のエポックと、古い版または古い値
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<const node>>> retired_nodes_ {};
+    std::vector<std::pair<std::uint64_t, std::unique_ptr<const cells_type>>> retired_values_ {};
+
+  public:
+    global_environment() = default;
+
+    global_environment(const global_environment&) = delete;
+    auto operator=(const global_environment&) -> global_environment& = delete;
+
+    // 区間の中で呼ぶこと。見つからなければ end()
+    auto find(const symbol_type& name) const noexcept
+      -> iterator
+    {
+      auto key {name.id()};
+
+      for (const auto* n {root_.load(std::memory_order_acquire)}; n; key >>= bits_)
+      {
+        const auto bit {node::bit(key, 0)};
+
+        if (not ((*n).bitmap & bit))
+        {
+          return nullptr;
+        }
+
+        const auto& entry {(*n).entries[(*n).position(bit)]};
+
+        if (entry.leaf)
+        {
+          return entry.leaf->first == name ? entry.leaf : nullptr;
+        }
+
+        n = entry.child.get();
+      }
+
+      return nullptr;
+    }
+
+    constexpr auto end() const noexcept
+      -> iterator
+    {
+      return nullptr;
+    }
+
+    // 既存の束縛は値だけを差し替え、新しい名前は版を作り直して公開する
+    auto insert_or_assign(const symbol_type& name, const cells_type& value)
+      -> binding&
+    {
+      auto replacement {std::make_unique<const cells_type>(value)};
+
+      std::lock_guard lock {writer_};
+
+      if (auto* b {find(name)}; b)
+      {
+        retired_values_.emplace_back(0, (*b).value_.exchange(replacement.release(), std::memory_order_seq_cst));
+        retire_(retired_values_.back().first);
+        return *b;
+      }
+
+      auto& b {bindings_.emplace_back(name, replacement.release())};
+
+      auto next {insert_(current_.get(), name.id(), 0, &b)};
+      root_.store(next.get(), std::memory_order_seq_cst);
+
+      retired_nodes_.emplace_back(0, std::exchange(current_, std::move(next)));
+      retire_(retired_nodes_.back().first);
+
+      return b;
+    }
+
+    // 区間の中で呼ぶこと。呼んだ時点の版の束縛を全て辿る
+    template <typename F>
+    void for_each(F&& f) const
+    {
+      if (const auto* n {root_.load(std::memory_order_acquire)}; n)
+      {
+        for_each_(*n, f);
+      }
+    }
+
+    // 差し替えた後に書き手が来なくても、読み手のいなくなった古い版と値を解放する
+    void reclaim()
+    {
+      std::lock_guard lock {writer_};
+      reclaim_();
+    }
+
+    // 読み手がいない時にだけ呼ぶこと
+    void clear()
+    {
+      std::lock_guard lock {writer_};
+
+      root_.store(nullptr, std::memory_order_relaxed);
+      current_.reset();
+
+      retired_nodes_.clear();
+      retired_values_.clear();
+      bindings_.clear();
+    }
+
+  protected:
+    // 差し替えに印を付け、どの読み手からも見えなくなったものを解放する
+    void retire_(std::uint64_t& epoch)
+    {
+      epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+      reclaim_();
+    }
+
+    void reclaim_()
+    {
+      if (std::empty(retired_nodes_) and std::empty(retired_values_))
+      {
+        return;
+      }
+
+      auto oldest {idle_};
+
+      {
+        std::lock_guard lock {slots_mutex_};
+
+        for (const auto& each : slots_)
+        {
+          oldest = std::min(oldest, each.epoch.load(std::memory_order_seq_cst));
+        }
+      }
+
+      const auto expired = [&](const auto& each)
+      {
+        return each.first < oldest;
+      };
+
+      retired_nodes_.erase(std::remove_if(std::begin(retired_nodes_), std::end(retired_nodes_), expired), std::end(retired_nodes_));
+      retired_values_.erase(std::remove_if(std::begin(retired_values_), std::end(retired_values_), expired), std::end(retired_values_));
+    }
+
+    // n に key の葉を加えた複製。n は書き換えない
+    static auto insert_(const node* n, std::size_t key, std::size_t shift, binding* leaf)
+      -> std::shared_ptr<const node>
+    {
+      auto result {n ? std::make_shared<node>(*n) : std::make_shared<node>()};
+
+      const auto bit {node::bit(key, shift)};
+      const auto position {(*result).position(bit)};
+
+      if (not ((*result).bitmap & bit))
+      {
+        (*result).bitmap |= bit;
+        (*result).entries.insert(std::next(std::begin((*result).entries), position), typename node::entry {nullptr, leaf});
+      }
+      else if (auto& entry {(*result).entries[position]}; entry.leaf) // 同じ枝に入る二つの葉を一段下に分ける
+      {
+        auto child {insert_(nullptr, entry.leaf->first.id(), shift + bits_, entry.leaf)};
+        entry = {insert_(child.get(), key, shift + bits_, leaf), nullptr};
+      }
+      else
+      {
+        entry.child = insert_(entry.child.get(), key, shift + bits_, leaf);
+      }
+
+      return result;
+    }
+
+    template <typename F>
+    static void for_each_(const node& n, F& f)
+    {
+      for (const auto& entry : n.entries)
+      {
+        if (entry.leaf)
+        {
+          f(entry.leaf->first, (*entry.leaf).value());
+        }
+        else
+        {
+          for_each_(*entry.child, f);
+        }
+      }
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_GLOBAL_ENVIRONMENT_HPP
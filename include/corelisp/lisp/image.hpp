@@ -0,0 +1,565 @@
+#ifndef INCLUDED_CORELISP_LISP_IMAGE_HPP
+#define INCLUDED_CORELISP_LISP_IMAGE_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/packed_vector.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/symbol.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 大域環境のイメージ。シンボルの名前表、捕捉されたフレーム、束縛の順に並べる。
+  // クロージャは lambda 式と外側の仮引数名、捕捉したフレームとして保存し、読み込み時に再解析する。
+  // memoize などの組み込み関数で包んだクロージャは、包んだ関数の名前と引数として保存し、読み込み時に呼び直す。
+  // 数値はホストのバイト順のまま書くので、同じ環境で作ったイメージのみ読み込める
+  class image
+  {
+  public:
+    using cells_type = vectored_cons_cells;
+    using symbol_type = typename cells_type::symbol_type;
+    using number_type = typename cells_type::number_type;
+
+    using arguments_type = typename analyzer::arguments_type;
+    using primitives_type = typename analyzer::primitives_type;
+    using globals_type = typename analyzer::globals_type;
+    using scope_type = typename analyzer::scope_type;
+
+    // lambda 式を scope の下で解析し、env を捕捉したクロージャを返す
+    using restore_type = std::function<cells_type (const cells_type&, const scope_type&, const environment&)>;
+
+  protected:
+    using word_type = std::uint64_t; // 個数と添字は LEB128 の可変長で書く
+
+    static constexpr char magic[8] {'c', 'o', 'r', 'e', 'l', 'i', 's', 'p'};
+    static constexpr std::uint32_t version {2};
+
+    using tag = typename cells_type::tag;
+
+    class encoder
+    {
+      std::vector<symbol_type> symbols_;
+      std::unordered_map<symbol_type, word_type> symbol_indices_;
+
+      std::unordered_map<const frame*, word_type> frame_indices_;
+
+    public:
+      std::string frames, globals;
+      word_type frame_count {0};
+
+      template <typename T>
+      static void write(std::string& out, const T& value)
+      {
+        static_assert(std::is_trivially_copyable<T>::value);
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+      }
+
+      static void word(std::string& out, word_type value)
+      {
+        for (; 0x80 <= value; value >>= 7)
+        {
+          out.push_back(static_cast<char>(value | 0x80));
+        }
+
+        out.push_back(static_cast<char>(value));
+      }
+
+      auto symbol(const symbol_type& s)
+        -> word_type
+      {
+        if (auto iter {symbol_indices_.find(s)}; iter != std::end(symbol_indices_))
+        {
+          return iter->second;
+        }
+
+        symbols_.push_back(s);
+        return symbol_indices_.emplace(s, std::size(symbols_) - 1).first->second;
+      }
+
+      // 親とスロット中のクロージャが捕捉したフレームを先に書くので、読み込みは前から順に行える。
+      // 添字は一つずらし、0 をトップレベル（空の環境）に充てる
+      auto capture(const environment& env)
+        -> word_type
+      {
+        if (not env)
+        {
+          return 0;
+        }
+        else if (auto iter {frame_indices_.find(env.get())}; iter != std::end(frame_indices_))
+        {
+          return iter->second;
+        }
+
+        const auto parent {(*this).capture((*env).parent)};
+
+        std::string slots {};
+
+        for (std::size_t index {0}; index < (*env).size(); ++index)
+        {
+          value(slots, (*env)[index]);
+        }
+
+        word(frames, parent);
+        word(frames, (*env).size());
+        frames += slots;
+
+        return frame_indices_.emplace(env.get(), ++frame_count).first->second;
+      }
+
+      void value(std::string& out, const cells_type& e)
+      {
+        const auto kind {e.kind()};
+        write(out, static_cast<std::uint8_t>(kind));
+
+        switch (kind)
+        {
+        case tag::null:
+          break;
+
+        case tag::symbol:
+          word(out, symbol(e.identifier()));
+          break;
+
+        case tag::boolean:
+          write(out, static_cast<std::uint8_t>(std::get<bool>(e.value)));
+          break;
+
+        case tag::fixnum:
+          {
+            const auto n {std::get<fixnum>(e.as_number())}; // 絶対値の小さい負数も短くなるようにジグザグ符号化する
+            word(out, (static_cast<word_type>(n) << 1) ^ static_cast<word_type>(n >> 63));
+          }
+          break;
+
+        case tag::flonum:
+          write(out, std::get<flonum>(e.as_number()));
+          break;
+
+        case tag::bignum:
+        case tag::ratnum:
+          {
+            std::stringstream ss {}; // 読み込みは数値の表記として読み直す
+            ss << e.as_number();
+            word(out, std::size(ss.str()));
+            out += ss.str();
+          }
+          break;
+
+        case tag::f64vector:
+          packed(out, e.as<f64vector>());
+          break;
+
+        case tag::i64vector:
+          packed(out, e.as<i64vector>());
+          break;
+
+        case tag::pair:
+          word(out, std::size(e));
+
+          for (const auto& each : e)
+          {
+            value(out, each);
+          }
+          break;
+
+        case tag::closure:
+          {
+            const auto& proc {*e.closure};
+
+            // 包んだものは 1 + 関数名、包まれた関数、残りの引数の順。素のクロージャは 0 に続けて本体を書く
+            bool wrapped {false};
+
+            if (proc.state)
+            {
+              (*proc.state).wrapper([&](const auto& name, const auto& function, const auto& arguments)
+              {
+                word(out, symbol(name) + 1);
+                value(out, function);
+                value(out, arguments);
+                wrapped = true;
+              });
+            }
+
+            if (wrapped)
+            {
+              break;
+            }
+
+            word(out, 0);
+
+            if (not proc.scope)
+            {
+              throw std::runtime_error {"image: closure without scope information"};
+            }
+
+            auto source {e};
+            source.closure = nullptr;
+            value(out, source);
+
+            word(out, std::size(*proc.scope));
+
+            for (const auto& params : *proc.scope)
+            {
+              word(out, std::size(params));
+
+              for (const auto& each : params)
+              {
+                word(out, symbol(each));
+              }
+            }
+
+            word(out, (*this).capture(proc.closure));
+          }
+          break;
+        }
+      }
+
+      template <typename T>
+      static void packed(std::string& out, const packed_vector<T>& v)
+      {
+        word(out, std::size(v));
+        out.append(reinterpret_cast<const char*>(std::data(v)), sizeof(T) * std::size(v));
+      }
+
+      void symbols(std::string& out) const
+      {
+        word(out, std::size(symbols_));
+
+        for (const auto& each : symbols_)
+        {
+          word(out, std::size(each.name()));
+          out += each.name();
+        }
+      }
+    };
+
+    // 読み込み専用に写像したファイル
+    class mapping
+    {
+      int fd_;
+      const char* data_ {nullptr};
+      std::size_t size_ {0};
+
+    public:
+      explicit mapping(const std::string& path)
+        : fd_ {::open(path.c_str(), O_RDONLY)}
+      {
+        if (fd_ < 0)
+        {
+          throw std::runtime_error {"image: failed to open " + path};
+        }
+
+        if (struct stat status {}; ::fstat(fd_, &status) == 0 and 0 < status.st_size)
+        {
+          size_ = status.st_size;
+
+          if (auto* p {::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0)}; p != MAP_FAILED)
+          {
+            data_ = static_cast<const char*>(p);
+            return;
+          }
+        }
+
+        ::close(fd_);
+        throw std::runtime_error {"image: failed to map " + path};
+      }
+
+      mapping(const mapping&) = delete;
+      auto operator=(const mapping&) -> mapping& = delete;
+
+      ~mapping()
+      {
+        ::munmap(const_cast<char*>(data_), size_);
+        ::close(fd_);
+      }
+
+      auto data() const noexcept
+      {
+        return data_;
+      }
+
+      auto size() const noexcept
+      {
+        return size_;
+      }
+    };
+
+    class decoder
+    {
+      const char* position_;
+      const char* const end_;
+
+      const restore_type& restore_;
+      const primitives_type& primitives_;
+
+    public:
+      std::vector<symbol_type> symbols;
+      std::vector<environment> frames;
+
+      decoder(const char* data, std::size_t size, const restore_type& restore, const primitives_type& primitives)
+        : position_ {data},
+          end_ {data + size},
+          restore_ {restore},
+          primitives_ {primitives}
+      {}
+
+      auto bytes(std::size_t size)
+        -> std::string_view
+      {
+        if (static_cast<std::size_t>(end_ - position_) < size)
+        {
+          throw std::runtime_error {"image: truncated"};
+        }
+
+        std::string_view result {position_, size};
+        position_ += size;
+        return result;
+      }
+
+      auto word()
+        -> word_type
+      {
+        word_type result {0};
+
+        for (unsigned shift {0}; shift < 64; shift += 7)
+        {
+          const auto byte {read<std::uint8_t>()};
+          result |= static_cast<word_type>(byte & 0x7f) << shift;
+
+          if (not (byte & 0x80))
+          {
+            return result;
+          }
+        }
+
+        throw std::runtime_error {"image: malformed word"};
+      }
+
+      template <typename T>
+      auto read()
+        -> T
+      {
+        static_assert(std::is_trivially_copyable<T>::value);
+
+        T result;
+        std::memcpy(&result, std::data(bytes(sizeof(T))), sizeof(T));
+        return result;
+      }
+
+      template <typename T>
+      auto packed()
+        -> packed_vector<T>
+      {
+        const auto size {word()};
+
+        if (static_cast<std::size_t>(end_ - position_) / sizeof(T) < size)
+        {
+          throw std::runtime_error {"image: truncated"};
+        }
+
+        const auto data {bytes(sizeof(T) * size)};
+
+        std::vector<T> buffer(size); // 写像したファイル上の位置は整列していない
+        std::memcpy(std::data(buffer), std::data(data), std::size(data));
+
+        return {std::begin(buffer), std::end(buffer)};
+      }
+
+      auto symbol()
+        -> const symbol_type&
+      {
+        return symbols.at(word());
+      }
+
+      auto captured()
+        -> environment
+      {
+        const auto index {word()};
+        return index != 0 ? frames.at(index - 1) : nullptr;
+      }
+
+      auto value()
+        -> cells_type
+      {
+        switch (static_cast<tag>(read<std::uint8_t>()))
+        {
+        case tag::null:
+          return {};
+
+        case tag::symbol:
+          return {symbol()};
+
+        case tag::boolean:
+          return read<std::uint8_t>() ? true_value : false_value;
+
+        case tag::fixnum:
+          {
+            const auto n {word()};
+            return {number_type {static_cast<fixnum>(n >> 1) ^ -static_cast<fixnum>(n & 1)}};
+          }
+
+        case tag::flonum:
+          return {number_type {read<flonum>()}};
+
+        case tag::bignum:
+        case tag::ratnum:
+          if (number_type n {}; number_type::read(bytes(word()), n))
+          {
+            return {n};
+          }
+          else throw std::runtime_error {"image: malformed number"};
+
+        case tag::f64vector:
+          return {packed<flonum>()};
+
+        case tag::i64vector:
+          return {packed<fixnum>()};
+
+        case tag::pair:
+          {
+            cells_type result {};
+
+            for (auto count {word()}; 0 < count; --count)
+            {
+              result.push_back(value());
+            }
+
+            return result;
+          }
+
+        case tag::closure:
+          if (const auto wrapper {word()}; wrapper)
+          {
+            const auto& name {symbols.at(wrapper - 1)};
+
+            arguments_type arguments {value()};
+
+            for (const auto& each : value())
+            {
+              arguments.push_back(each);
+            }
+
+            if (auto iter {primitives_.find(name)}; iter != std::end(primitives_))
+            {
+              return iter->second(arguments);
+            }
+            else throw std::runtime_error {"image: unknown wrapper " + name.name()};
+          }
+          else
+          {
+            const auto source {value()};
+
+            scope_type scope(word());
+
+            for (auto& params : scope)
+            {
+              params.resize(word());
+
+              for (auto& each : params)
+              {
+                each = symbol();
+              }
+            }
+
+            return restore_(source, scope, captured());
+          }
+
+        default:
+          throw std::runtime_error {"image: unknown tag"};
+        }
+      }
+    };
+
+  public:
+    static void save(const globals_type& globals, const std::string& path)
+    {
+      encoder w {};
+
+      std::size_t count {0};
+
+      globals.for_each([&](const auto& name, const auto& value)
+      {
+        encoder::word(w.globals, w.symbol(name));
+        w.value(w.globals, value);
+        ++count;
+      });
+
+      std::string out {magic, sizeof(magic)};
+      encoder::write(out, version);
+      w.symbols(out);
+      encoder::word(out, w.frame_count);
+      out += w.frames;
+      encoder::word(out, count);
+      out += w.globals;
+
+      if (std::ofstream ofs {path, std::ios::binary | std::ios::trunc}; not ofs.write(std::data(out), std::size(out)))
+      {
+        throw std::runtime_error {"image: failed to write " + path};
+      }
+    }
+
+    // 既存の束縛は上書きする。包んだクロージャは primitives の同名の関数で包み直す
+    static void load(globals_type& globals, const std::string& path, const restore_type& restore, const primitives_type& primitives)
+    {
+      const mapping file {path};
+
+      decoder r {file.data(), file.size(), restore, primitives};
+
+      if (r.bytes(sizeof(magic)) != std::string_view {magic, sizeof(magic)} or r.read<std::uint32_t>() != version)
+      {
+        throw std::runtime_error {"image: not a corelisp image: " + path};
+      }
+
+      r.symbols.resize(r.word());
+
+      for (auto& each : r.symbols)
+      {
+        each = symbol_type {r.bytes(r.word())};
+      }
+
+      r.frames.resize(r.word());
+
+      for (auto& each : r.frames)
+      {
+        auto parent {r.captured()};
+        each = frame::make(parent, r.word());
+
+        for (std::size_t index {0}; index < (*each).size(); ++index)
+        {
+          (*each)[index] = r.value();
+        }
+      }
+
+      for (auto count {r.word()}; 0 < count; --count)
+      {
+        const auto name {r.symbol()};
+        globals.insert_or_assign(name, r.value());
+      }
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_IMAGE_HPP
@@ -0,0 +1,57 @@
+#ifndef INCLUDED_CORELISP_LISP_INLINE_CACHE_HPP
+#define INCLUDED_CORELISP_LISP_INLINE_CACHE_HPP
+
+
+#include <atomic>
+#include <iterator>
+
+#include <corelisp/lisp/symbol.hpp>
+
+
+namespace lisp
+{
+  // 参照箇所毎に、前回引いた表（大域環境やビルトインの表）の要素を一つだけ覚えておく。
+  // 表の要素は削除されず、unordered_map の要素は再ハッシュでも、大域環境の束縛は版の差し替えでも移動しない。
+  // 再定義は要素の値を差し替えるだけなので、名前が同じ限り覚えた要素を無効化せずに使い続けられる。
+  // 名前が変わる箇所（関数の位置が値として渡されたビルトインの名前など）では引き直して置き換える
+  template <typename Map>
+  class inline_cache
+  {
+    using entry_type = typename Map::value_type;
+
+    mutable std::atomic<entry_type*> entry_ {nullptr}; // ノードは複数のスレッドから同時に評価されうる
+
+  public:
+    inline_cache() = default;
+
+    inline_cache(const inline_cache& other) noexcept
+      : entry_ {other.entry_.load(std::memory_order_relaxed)}
+    {}
+
+    auto operator=(const inline_cache& other) noexcept
+      -> inline_cache&
+    {
+      entry_.store(other.entry_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      return *this;
+    }
+
+    // 見つからなければ空。未定義の名前は覚えず、定義されるまで毎回引く
+    auto find(Map& map, const symbol& name) const
+      -> entry_type*
+    {
+      if (auto* entry {entry_.load(std::memory_order_acquire)}; entry and entry->first == name)
+      {
+        return entry;
+      }
+      else if (auto iter {map.find(name)}; iter != std::end(map))
+      {
+        entry_.store(&*iter, std::memory_order_release);
+        return &*iter;
+      }
+      else return nullptr;
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_INLINE_CACHE_HPP
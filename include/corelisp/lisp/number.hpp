@@ -0,0 +1,373 @@
+#ifndef INCLUDED_CORELISP_LISP_NUMBER_HPP
+#define INCLUDED_CORELISP_LISP_NUMBER_HPP
+
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <variant>
+
+#include <boost/multiprecision/gmp.hpp>
+
+
+namespace lisp
+{
+  using fixnum = std::int64_t;
+  using flonum = double;
+
+  // fixnum に収まらない整数と、整数でない有理数。不変なので複製は参照の複製で済む
+  using bignum = std::shared_ptr<const boost::multiprecision::mpz_int>;
+  using ratnum = std::shared_ptr<const boost::multiprecision::mpq_rational>;
+
+  // 正確数は fixnum のまま演算し、桁溢れすれば bignum に、割り切れない除算は ratnum に昇格する。
+  // 結果は常に最も小さい表現に戻すので、一つの正確数の表現は一通りしかない。
+  // 浮動小数点数になるのは、浮動小数点数のリテラルか非正確数が混ざった場合だけ
+  class number
+    : public std::variant<fixnum, flonum, bignum, ratnum>
+  {
+    using base_type = std::variant<fixnum, flonum, bignum, ratnum>;
+
+  public:
+    using integer_type = boost::multiprecision::mpz_int;
+    using rational_type = boost::multiprecision::mpq_rational;
+
+    using base_type::base_type;
+
+    bool is_exact() const noexcept
+    {
+      return not std::holds_alternative<flonum>(*this);
+    }
+
+    bool is_fixnum() const noexcept
+    {
+      return std::holds_alternative<fixnum>(*this);
+    }
+
+    bool is_integer() const noexcept
+    {
+      return std::holds_alternative<fixnum>(*this) or std::holds_alternative<bignum>(*this);
+    }
+
+    auto inexact() const noexcept
+      -> flonum
+    {
+      return std::visit([](const auto& x)
+      {
+        using type = std::decay_t<decltype(x)>;
+
+        if constexpr (std::is_same_v<type, bignum> or std::is_same_v<type, ratnum>)
+        {
+          return (*x).template convert_to<flonum>();
+        }
+        else return static_cast<flonum>(x);
+      }, static_cast<const base_type&>(*this));
+    }
+
+    // 正確な整数として。is_integer() でなければ例外を送出する
+    auto integer() const
+      -> integer_type
+    {
+      if (const auto* n {std::get_if<fixnum>(this)}; n)
+      {
+        return *n;
+      }
+      else return *std::get<bignum>(*this);
+    }
+
+    // 正確な有理数として。is_exact() でなければ例外を送出する
+    auto rational() const
+      -> rational_type
+    {
+      if (const auto* q {std::get_if<ratnum>(this)}; q)
+      {
+        return **q;
+      }
+      else return rational_type {integer()};
+    }
+
+    static auto make(integer_type&& n)
+      -> number
+    {
+      if (std::numeric_limits<fixnum>::min() <= n and n <= std::numeric_limits<fixnum>::max())
+      {
+        return n.template convert_to<fixnum>();
+      }
+      else return std::make_shared<const integer_type>(std::move(n));
+    }
+
+    static auto make(rational_type&& q)
+      -> number
+    {
+      if (boost::multiprecision::denominator(q) == 1)
+      {
+        return make(integer_type {boost::multiprecision::numerator(q)});
+      }
+      else return std::make_shared<const rational_type>(std::move(q));
+    }
+
+    // 数値として読めない場合は偽を返す
+    static bool read(std::string_view token, number& result) noexcept
+    {
+      if (not std::empty(token) and token.front() == '+') // std::from_chars は正符号を受け付けない
+      {
+        token.remove_prefix(1);
+      }
+
+      const auto digits {not std::empty(token) and token.front() == '-' ? token.substr(1) : token};
+
+      if (std::empty(digits) or not (std::isdigit(static_cast<unsigned char>(digits.front())) or digits.front() == '.'))
+      {
+        return false;
+      }
+
+      const auto parse = [first = std::data(token), last = std::data(token) + std::size(token)](auto& buffer)
+      {
+        const auto [ptr, ec] {std::from_chars(first, last, buffer)};
+        return ptr == last ? ec : std::errc::invalid_argument;
+      };
+
+      if (fixnum buffer {}; parse(buffer) == std::errc {})
+      {
+        return result = buffer, true;
+      }
+
+      // fixnum に収まらない整数と n/d の形の分数は正確数として読む
+      if (const auto slash {digits.find('/')}; all_digits_(digits.substr(0, slash)) and (slash == std::string_view::npos or all_digits_(digits.substr(slash + 1))))
+      {
+        try
+        {
+          if (slash == std::string_view::npos)
+          {
+            return result = make(integer_(token)), true;
+          }
+          else if (auto denominator {integer_(digits.substr(slash + 1))}; denominator != 0)
+          {
+            return result = make(rational_type {integer_(token.substr(0, std::size(token) - std::size(digits) + slash)), std::move(denominator)}), true;
+          }
+          else return false;
+        }
+        catch (...)
+        {
+          return false;
+        }
+      }
+
+      flonum buffer {};
+
+      if (const auto ec {parse(buffer)}; ec == std::errc {})
+      {
+        return result = buffer, true;
+      }
+      else if (ec == std::errc::result_out_of_range) try // 桁溢れは無限大に、桁落ちは 0 か非正規化数に丸める
+      {
+        return result = std::strtod(std::string {token}.c_str(), nullptr), true;
+      }
+      catch (...)
+      {
+        return false;
+      }
+      else return false;
+    }
+
+  protected:
+    static bool all_digits_(std::string_view s) noexcept
+    {
+      return not std::empty(s) and std::all_of(std::begin(s), std::end(s), [](unsigned char c) { return std::isdigit(c); });
+    }
+
+    // 先頭の 0 を八進数の接頭辞として扱わないよう、基数を与えて読む
+    static auto integer_(std::string_view s)
+      -> integer_type
+    {
+      integer_type result {};
+      mpz_set_str(result.backend().data(), std::string {s}.c_str(), 10);
+      return result;
+    }
+
+    // 両方 fixnum なら桁溢れを検査して fixnum で、どちらかが非正確数なら flonum で、それ以外は多倍長で演算する
+    template <typename Fixnum, typename Exact, typename Inexact>
+    static auto apply_(const number& lhs, const number& rhs, Fixnum&& fixnum_, Exact&& exact, Inexact&& inexact)
+      -> number
+    {
+      if (const auto* x {std::get_if<fixnum>(&lhs)}, * y {std::get_if<fixnum>(&rhs)}; x and y)
+      {
+        if (fixnum buffer {}; fixnum_(*x, *y, buffer))
+        {
+          return buffer;
+        }
+      }
+
+      if (lhs.is_exact() and rhs.is_exact())
+      {
+        return lhs.is_integer() and rhs.is_integer() ? make(integer_type {exact(lhs.integer(), rhs.integer())})
+                                                     : make(rational_type {exact(lhs.rational(), rhs.rational())});
+      }
+      else return inexact(lhs.inexact(), rhs.inexact());
+    }
+
+    // 有限の浮動小数点数は正確な有理数として表せる
+    static auto exact_(const number& n)
+      -> rational_type
+    {
+      if (const auto* x {std::get_if<flonum>(&n)}; x)
+      {
+        rational_type result {};
+        mpq_set_d(result.backend().data(), *x);
+        return result;
+      }
+      else return n.rational();
+    }
+
+    // 浮動小数点数と正確数は、浮動小数点数を正確数に直して比べる（double に丸めると 2^53 を超える整数などを取り違える）。
+    // 無限大と NaN はどの正確数とも大小が同じなので、0 と比べる
+    template <typename Comparator>
+    static bool compare_(const number& lhs, const number& rhs, Comparator&& compare)
+    {
+      constexpr auto exact_limit {fixnum {1} << std::numeric_limits<flonum>::digits};
+
+      const auto* x {std::get_if<flonum>(&lhs)};
+      const auto* y {std::get_if<flonum>(&rhs)};
+
+      if (const auto* m {std::get_if<fixnum>(&lhs)}, * n {std::get_if<fixnum>(&rhs)}; m and n)
+      {
+        return compare(*m, *n);
+      }
+      else if (x and y)
+      {
+        return compare(*x, *y);
+      }
+      else if (x or y)
+      {
+        if (x and not std::isfinite(*x))
+        {
+          return compare(*x, 0.0);
+        }
+        else if (y and not std::isfinite(*y))
+        {
+          return compare(0.0, *y);
+        }
+        else if (const auto* n {std::get_if<fixnum>(x ? &rhs : &lhs)}; n and -exact_limit <= *n and *n <= exact_limit) // double で正確に表せる
+        {
+          return compare(lhs.inexact(), rhs.inexact());
+        }
+        else return compare(exact_(lhs), exact_(rhs));
+      }
+      else if (lhs.is_integer() and rhs.is_integer())
+      {
+        return compare(lhs.integer(), rhs.integer());
+      }
+      else return compare(lhs.rational(), rhs.rational());
+    }
+
+  public: // arithmetic operators
+    friend auto operator+(const number& lhs, const number& rhs)
+      -> number
+    {
+      return apply_(lhs, rhs, [](auto x, auto y, auto& z) { return not __builtin_add_overflow(x, y, &z); }, [](const auto& x, const auto& y) { return x + y; }, std::plus<flonum> {});
+    }
+
+    friend auto operator-(const number& lhs, const number& rhs)
+      -> number
+    {
+      return apply_(lhs, rhs, [](auto x, auto y, auto& z) { return not __builtin_sub_overflow(x, y, &z); }, [](const auto& x, const auto& y) { return x - y; }, std::minus<flonum> {});
+    }
+
+    friend auto operator*(const number& lhs, const number& rhs)
+      -> number
+    {
+      return apply_(lhs, rhs, [](auto x, auto y, auto& z) { return not __builtin_mul_overflow(x, y, &z); }, [](const auto& x, const auto& y) { return x * y; }, std::multiplies<flonum> {});
+    }
+
+    // 正確数同士で割り切れなければ有理数になる
+    friend auto operator/(const number& lhs, const number& rhs)
+      -> number
+    {
+      if (const auto* y {std::get_if<fixnum>(&rhs)}; y and *y == 0) // 正確数の零は fixnum でしか表さない
+      {
+        throw std::domain_error {"division by zero"};
+      }
+
+      if (lhs.is_exact() and rhs.is_exact())
+      {
+        if (const auto* x {std::get_if<fixnum>(&lhs)}, * y {std::get_if<fixnum>(&rhs)}; x and y and not (*x == std::numeric_limits<fixnum>::min() and *y == -1) and *x % *y == 0) // 剰余も桁溢れする
+        {
+          return *x / *y;
+        }
+        else return make(rational_type {lhs.rational() / rhs.rational()});
+      }
+      else return lhs.inexact() / rhs.inexact();
+    }
+
+  public: // comparison operators
+    friend bool operator==(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::equal_to<void> {});
+    }
+
+    friend bool operator!=(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::not_equal_to<void> {});
+    }
+
+    friend bool operator<(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::less<void> {});
+    }
+
+    friend bool operator<=(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::less_equal<void> {});
+    }
+
+    friend bool operator>(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::greater<void> {});
+    }
+
+    friend bool operator>=(const number& lhs, const number& rhs)
+    {
+      return compare_(lhs, rhs, std::greater_equal<void> {});
+    }
+
+    friend auto operator<<(std::ostream& os, const number& n)
+      -> std::ostream&
+    {
+      if (const auto* x {std::get_if<fixnum>(&n)}; x)
+      {
+        return os << *x;
+      }
+      else if (const auto* x {std::get_if<bignum>(&n)}; x)
+      {
+        return os << (**x).str();
+      }
+      else if (const auto* x {std::get_if<ratnum>(&n)}; x)
+      {
+        return os << (**x).str();
+      }
+
+      char buffer[32] {};
+      const auto [last, ec] {std::to_chars(buffer, buffer + sizeof(buffer), std::get<flonum>(n))};
+
+      const std::string_view text {buffer, static_cast<std::size_t>(last - buffer)};
+      os << text;
+
+      // 正確数と区別できるように、整数値の浮動小数点数には小数点を付ける
+      return text.find_first_of(".einf") == std::string_view::npos ? os << ".0" : os;
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_NUMBER_HPP
@@ -0,0 +1,416 @@
+#ifndef INCLUDED_CORELISP_LISP_OPTIMIZER_HPP
+#define INCLUDED_CORELISP_LISP_OPTIMIZER_HPP
+
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <iterator>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 解析（またはコンパイル）の前に式を書き換える。
+  //   - 畳み込み可能と登録したビルトインの定数引数での呼び出しを結果に置き換える
+  //   - 条件が定数の if と cond の節を刈り込む
+  //   - 小さく再帰しない大域の関数の呼び出しを、本体に引数を代入したものに置き換える
+  // 展開は (%inline name f expansion call) として残し、実行時に name の値がまだ f であることを
+  // 確かめてから展開を評価する（再定義されていれば元の呼び出しを評価する）。
+  // 書き換えた lambda 式は (%lambda source lambda) として、クロージャの表示と保存には元の式を使わせる
+  class optimizer
+  {
+  public:
+    using cells_type = vectored_cons_cells;
+    using symbol_type = typename cells_type::symbol_type;
+
+    using primitives_type = typename analyzer::primitives_type;
+    using globals_type = typename analyzer::globals_type;
+    using scope_type = typename analyzer::scope_type;
+
+    static constexpr std::size_t inline_size {32}; // 展開する本体の大きさ（アトムの数）の上限
+    static constexpr std::size_t inline_depth {2};  // 展開した本体の中をさらに展開する深さ
+
+    std::ostream* log {nullptr}; // 空でなければ書き換え毎に一行書く
+
+  protected:
+    primitives_type& primitives_;
+    globals_type& globals_;
+
+    // 登録時に入っていた関数の型。差し替えられたビルトインは畳み込まない
+    std::unordered_map<symbol_type, std::type_index> foldable_ {};
+
+  public:
+    optimizer(primitives_type& primitives, globals_type& globals)
+      : primitives_ {primitives},
+        globals_ {globals}
+    {}
+
+    // name の今のビルトインを、副作用がなく定数引数で呼び出し時に畳み込んでよいものとして登録する
+    void foldable(const symbol_type& name)
+    {
+      if (auto iter {primitives_.find(name)}; iter != std::end(primitives_))
+      {
+        foldable_.insert_or_assign(name, std::type_index {iter->second.target_type()});
+      }
+    }
+
+    auto operator()(const cells_type& e, const scope_type& scope = {})
+      -> cells_type
+    {
+      return optimize_(e, scope, 0);
+    }
+
+  protected:
+    static auto bound_(const symbol_type& name, const scope_type& scope)
+    {
+      return std::any_of(std::begin(scope), std::end(scope), [&](const auto& params)
+      {
+        return std::find(std::begin(params), std::end(params), name) != std::end(params);
+      });
+    }
+
+    static auto is_quote_(const cells_type& e)
+    {
+      return not e.is_atom() and std::size(e) == 2 and e[0].identifier() == symbol_type {"quote"};
+    }
+
+    // 評価すると常に同じ値になる式（自己評価的なアトムと quote）
+    static auto is_constant_(const cells_type& e)
+    {
+      return (e.is_atom() and not e.identifier() and not e.closure) or is_quote_(e);
+    }
+
+    static auto value_(const cells_type& e)
+      -> cells_type
+    {
+      return is_quote_(e) ? e[1] : e;
+    }
+
+    static auto literal_(const cells_type& value)
+      -> cells_type
+    {
+      if (value.is_atom() and not value.identifier() and not value.closure and (not value.packed or value.is_number()))
+      {
+        return value;
+      }
+
+      cells_type result {};
+      result.push_back(cells_type {symbol_type {"quote"}});
+      result.push_back(value);
+      return result;
+    }
+
+    auto rewrite_(const char* what, const cells_type& before, const cells_type& after) const
+      -> cells_type
+    {
+      if (log)
+      {
+        *log << "; " << what << " " << before << " => " << after << std::endl;
+      }
+
+      return after;
+    }
+
+    auto optimize_(const cells_type& e, const scope_type& scope, std::size_t depth)
+      -> cells_type
+    {
+      if (e.is_atom() or std::empty(e))
+      {
+        return e;
+      }
+
+      const auto name {e[0].identifier()};
+
+      if (not name or bound_(name, scope))
+      {
+        return each_(e, 0, scope, depth);
+      }
+      else if (name == symbol_type {"quote"} or name == symbol_type {"%inline"} or name == symbol_type {"%lambda"})
+      {
+        return e;
+      }
+      else if (name == symbol_type {"lambda"})
+      {
+        if (std::size(e) != 3 or e[1].is_atom())
+        {
+          return e;
+        }
+
+        auto inner {scope};
+        inner.emplace_back();
+
+        for (const auto& each : e[1])
+        {
+          inner.back().push_back(each.identifier());
+        }
+
+        cells_type result {};
+        result.push_back(cells_type {symbol_type {"%lambda"}});
+        result.push_back(e);
+        result.push_back(map_(e, 2, [&](const auto& each)
+        {
+          return optimize_(each, inner, depth);
+        }));
+        return result;
+      }
+      else if (name == symbol_type {"define"} or name == symbol_type {"define-memo"})
+      {
+        return std::size(e) == 3 ? each_(e, 2, scope, depth) : e;
+      }
+      else if (name == symbol_type {"if"})
+      {
+        return if_(e, scope, depth);
+      }
+      else if (name == symbol_type {"cond"})
+      {
+        return cond_(e, scope, depth);
+      }
+      else if (analyzer::syntactic(name))
+      {
+        return each_(e, 1, scope, depth);
+      }
+      else if (auto iter {primitives_.find(name)}; iter != std::end(primitives_))
+      {
+        return fold_(iter->second, each_(e, 1, scope, depth));
+      }
+      else return inline_(each_(e, 1, scope, depth), scope, depth);
+    }
+
+    // offset 番目以降の要素を f で置き換えたリスト
+    template <typename F>
+    static auto map_(const cells_type& e, std::size_t offset, F&& f)
+      -> cells_type
+    {
+      cells_type result {};
+      result.reserve(std::size(e));
+
+      for (auto iter {std::begin(e)}; iter != std::end(e); ++iter)
+      {
+        result.push_back(offset <= std::size(result) ? f(*iter) : *iter);
+      }
+
+      return result;
+    }
+
+    // offset 番目以降の要素をそれぞれ最適化する
+    auto each_(const cells_type& e, std::size_t offset, const scope_type& scope, std::size_t depth)
+      -> cells_type
+    {
+      return map_(e, offset, [&](const auto& each)
+      {
+        return optimize_(each, scope, depth);
+      });
+    }
+
+    auto if_(const cells_type& e, const scope_type& scope, std::size_t depth)
+      -> cells_type
+    {
+      if (std::size(e) != 4)
+      {
+        return e;
+      }
+
+      if (const auto test {optimize_(e[1], scope, depth)}; is_constant_(test))
+      {
+        return rewrite_("prune", e, optimize_(value_(test) ? e[2] : e[3], scope, depth));
+      }
+      else return each_(e, 1, scope, depth);
+    }
+
+    // 条件が定数の偽の節は捨て、定数の真の節より後ろは到達しないので捨てる
+    auto cond_(const cells_type& e, const scope_type& scope, std::size_t depth)
+      -> cells_type
+    {
+      cells_type result {};
+      result.push_back(e[0]);
+
+      for (auto iter {std::next(std::begin(e))}; iter != std::end(e); ++iter)
+      {
+        if ((*iter).is_atom() or std::size(*iter) < 2)
+        {
+          return e; // 解析時にエラーにさせる
+        }
+
+        auto clause {each_(*iter, 0, scope, depth)};
+
+        if (not is_constant_(clause[0]))
+        {
+          result.push_back(std::move(clause));
+        }
+        else if (value_(clause[0]))
+        {
+          if (std::size(result) == 1)
+          {
+            return rewrite_("prune", e, clause[1]);
+          }
+
+          result.push_back(std::move(clause));
+          break;
+        }
+      }
+
+      if (std::size(result) == 1)
+      {
+        return rewrite_("prune", e, false_value);
+      }
+      else if (std::size(result) != std::size(e))
+      {
+        return rewrite_("prune", e, result);
+      }
+      else return result;
+    }
+
+    auto fold_(const analyzer::primitive_type& primitive, const cells_type& e)
+      -> cells_type
+    {
+      if (auto iter {foldable_.find(e[0].identifier())}; iter == std::end(foldable_) or iter->second != std::type_index {primitive.target_type()})
+      {
+        return e;
+      }
+
+      analyzer::arguments_type args {};
+
+      for (auto iter {std::next(std::begin(e))}; iter != std::end(e); ++iter)
+      {
+        if (not is_constant_(*iter))
+        {
+          return e;
+        }
+
+        args.push_back(value_(*iter));
+      }
+
+      try
+      {
+        return rewrite_("fold", e, literal_(primitive(args)));
+      }
+      catch (...) // エラーは実行時に起こさせる
+      {
+        return e;
+      }
+    }
+
+    // 本体が小さく、束縛を作らず、自身を参照しない関数なら展開できる
+    static auto inlinable_(const cells_type& e, const symbol_type& self, std::size_t& size)
+      -> bool
+    {
+      if (e.is_atom())
+      {
+        return e.identifier() != self and ++size <= inline_size;
+      }
+      else if (is_quote_(e))
+      {
+        return ++size <= inline_size;
+      }
+      else if (not std::empty(e) and e[0].identifier() and analyzer::syntactic(e[0].identifier()) and e[0].identifier() != symbol_type {"if"} and e[0].identifier() != symbol_type {"cond"})
+      {
+        return false;
+      }
+
+      return std::all_of(std::begin(e), std::end(e), [&](const auto& each)
+      {
+        return inlinable_(each, self, size);
+      });
+    }
+
+    // 仮引数を実引数で置き換える。quote の中は置き換えない
+    static auto substitute_(const cells_type& e, const cells_type& params, const cells_type& args)
+      -> cells_type
+    {
+      if (e.is_atom())
+      {
+        for (std::size_t index {0}; index < std::size(params); ++index)
+        {
+          if (e.identifier() and e.identifier() == params[index].identifier())
+          {
+            return args[index + 1];
+          }
+        }
+
+        return e;
+      }
+      else if (is_quote_(e))
+      {
+        return e;
+      }
+
+      return map_(e, 0, [&](const auto& each)
+      {
+        return substitute_(each, params, args);
+      });
+    }
+
+    // 呼び出し側の局所変数が本体の自由変数を隠していないこと
+    static auto hygienic_(const cells_type& e, const cells_type& params, const scope_type& scope)
+      -> bool
+    {
+      if (e.is_atom())
+      {
+        const auto name {e.identifier()};
+
+        return not name or std::any_of(std::begin(params), std::end(params), [&](const auto& each) { return each.identifier() == name; }) or not bound_(name, scope);
+      }
+
+      return is_quote_(e) or std::all_of(std::begin(e), std::end(e), [&](const auto& each)
+      {
+        return hygienic_(each, params, scope);
+      });
+    }
+
+    auto inline_(const cells_type& e, const scope_type& scope, std::size_t depth)
+      -> cells_type
+    {
+      const auto name {e[0].identifier()};
+
+      const auto iter {globals_.find(name)};
+
+      if (inline_depth <= depth or iter == std::end(globals_) or not (*iter).value().closure or (*(*iter).value().closure).closure or (*(*iter).value().closure).opaque)
+      {
+        return e;
+      }
+
+      const auto& f {(*iter).value()};
+
+      if (std::size(f) != 3 or f[1].is_atom() or std::size(f[1]) != std::size(e) - 1)
+      {
+        return e;
+      }
+
+      // 実引数は評価の回数や時点が変わっても結果が同じもの（定数と局所変数）に限る。
+      // 大域変数は本体の途中の呼び出しで再定義されうるので含めない
+      for (auto each {std::next(std::begin(e))}; each != std::end(e); ++each)
+      {
+        if (not is_constant_(*each) and not ((*each).identifier() and bound_((*each).identifier(), scope) and not analyzer::syntactic((*each).identifier())))
+        {
+          return e;
+        }
+      }
+
+      if (std::size_t size {0}; not inlinable_(f[2], name, size) or not hygienic_(f[2], f[1], scope))
+      {
+        return e;
+      }
+
+      cells_type result {};
+      result.push_back(cells_type {symbol_type {"%inline"}});
+      result.push_back(e[0]);
+      result.push_back(f);
+      result.push_back(optimize_(substitute_(f[2], f[1], e), scope, depth + 1));
+      result.push_back(e);
+
+      rewrite_("inline", e, result[3]);
+
+      return result;
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_OPTIMIZER_HPP
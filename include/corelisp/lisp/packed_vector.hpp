@@ -0,0 +1,378 @@
+#ifndef INCLUDED_CORELISP_LISP_PACKED_VECTOR_HPP
+#define INCLUDED_CORELISP_LISP_PACKED_VECTOR_HPP
+
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#include <boost/functional/hash.hpp>
+
+#include <corelisp/lisp/number.hpp>
+
+
+// GCC/Clang ではベクトル拡張で一度に 16 バイト（SSE2 や NEON のレジスタ一本）分の要素を演算する
+#if defined(__GNUC__) && !defined(CORELISP_NO_VECTOR_EXTENSIONS)
+#define CORELISP_VECTOR_EXTENSIONS 1
+#else
+#define CORELISP_VECTOR_EXTENSIONS 0
+#endif
+
+
+namespace lisp
+{
+  // 同じ型の数値を詰めて並べた不変なベクトル。記憶域は整列しておき、ブロック単位の端数を 0 で埋めて
+  // 確保するので、要素毎の演算は端数の処理なしにブロック単位で回せる。複製は記憶域を共有するだけ。
+  // 整数の演算は 2 の 64 乗を法として折り返す（数値のように浮動小数点数へは昇格しない）
+  template <typename T>
+  class packed_vector
+  {
+    static_assert(std::is_arithmetic<T>::value);
+
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    using const_iterator = const T*;
+    using iterator = const_iterator;
+
+    static constexpr size_type alignment {64};
+
+#if CORELISP_VECTOR_EXTENSIONS
+    static constexpr size_type lanes {16 / sizeof(T)};
+#else
+    static constexpr size_type lanes {1};
+#endif
+
+  protected:
+    // 整数は符号なしで演算して桁溢れを未定義動作にしない
+    using wrapping_type = typename std::conditional<std::is_integral<T>::value, std::make_unsigned<T>, std::common_type<T>>::type::type;
+
+#if CORELISP_VECTOR_EXTENSIONS
+    typedef T block_type __attribute__((vector_size(16), __may_alias__));
+    typedef wrapping_type wrapping_block_type __attribute__((vector_size(16), __may_alias__));
+#else
+    using block_type = T;
+    using wrapping_block_type = wrapping_type;
+#endif
+
+    struct deallocate
+    {
+      void operator()(T* p) const noexcept
+      {
+        ::operator delete(p, std::align_val_t {alignment});
+      }
+    };
+
+    std::shared_ptr<T> data_ {};
+    size_type size_ {0};
+
+    auto blocks_() const noexcept
+    {
+      return (size_ + lanes - 1) / lanes;
+    }
+
+    // 端数のみ 0 で初期化する。要素は呼び出し側が全て書き込むこと
+    explicit packed_vector(size_type size, std::nullptr_t)
+      : size_ {size}
+    {
+      if (max_size() < size_) // 確保する大きさの計算が桁溢れしないこと
+      {
+        throw std::length_error {"packed_vector: too many elements"};
+      }
+      else if (size_ != 0)
+      {
+        const auto capacity {blocks_() * lanes};
+
+        auto* buffer {static_cast<T*>(::operator new(sizeof(T) * capacity, std::align_val_t {alignment}))};
+        std::uninitialized_fill(buffer + size_, buffer + capacity, T {});
+        data_.reset(buffer, deallocate {});
+      }
+    }
+
+  public:
+    packed_vector() = default;
+
+    packed_vector(size_type size, T fill)
+      : packed_vector {size, nullptr}
+    {
+      std::uninitialized_fill_n(data_.get(), size_, fill);
+    }
+
+    template <typename InputIterator>
+    packed_vector(InputIterator first, InputIterator last)
+      : packed_vector {static_cast<size_type>(std::distance(first, last)), nullptr}
+    {
+      std::uninitialized_copy(first, last, data_.get());
+    }
+
+  public: // accesses
+    auto size() const noexcept
+    {
+      return size_;
+    }
+
+    // 端数を埋めたブロックの大きさが ptrdiff_t に収まる要素数
+    static constexpr auto max_size() noexcept
+      -> size_type
+    {
+      return static_cast<size_type>(std::numeric_limits<std::ptrdiff_t>::max()) / sizeof(T) / lanes * lanes;
+    }
+
+    auto data() const noexcept
+      -> const T*
+    {
+      return data_.get();
+    }
+
+    auto begin() const noexcept
+    {
+      return data();
+    }
+
+    auto end() const noexcept
+    {
+      return data() + size_;
+    }
+
+    auto at(size_type index) const
+      -> T
+    {
+      if (size_ <= index)
+      {
+        throw std::out_of_range {"packed_vector::at"};
+      }
+
+      return data_.get()[index];
+    }
+
+  protected: // kernels
+    static void check_size_(const packed_vector& lhs, const packed_vector& rhs)
+    {
+      if (lhs.size_ != rhs.size_)
+      {
+        throw std::invalid_argument {"length mismatch"};
+      }
+    }
+
+    // 結果の端数は f(0, 0) になるので、演算後に 0 へ戻しておく
+    template <typename Block, typename F>
+    static auto zip_(const packed_vector& lhs, const packed_vector& rhs, F&& f)
+      -> packed_vector
+    {
+      check_size_(lhs, rhs);
+
+      packed_vector result {lhs.size_, nullptr};
+
+      auto* z {reinterpret_cast<Block*>(result.data_.get())};
+      const auto* x {reinterpret_cast<const Block*>(lhs.data_.get())};
+      const auto* y {reinterpret_cast<const Block*>(rhs.data_.get())};
+
+      for (size_type index {0}, blocks {lhs.blocks_()}; index < blocks; ++index)
+      {
+        z[index] = f(x[index], y[index]);
+      }
+
+      std::fill(result.data_.get() + result.size_, result.data_.get() + result.blocks_() * lanes, T {});
+
+      return result;
+    }
+
+    // すべての要素の組で compare が成り立つか。端数を比べないよう最後のブロックは要素毎に見る
+    template <typename Compare>
+    static bool all_(const packed_vector& lhs, const packed_vector& rhs, Compare&& compare)
+    {
+      if (lhs.size_ != rhs.size_)
+      {
+        return false;
+      }
+
+      const auto* x {reinterpret_cast<const block_type*>(lhs.data_.get())};
+      const auto* y {reinterpret_cast<const block_type*>(rhs.data_.get())};
+
+      const auto whole {lhs.size_ / lanes};
+
+      for (size_type index {0}; index < whole; ++index)
+      {
+#if CORELISP_VECTOR_EXTENSIONS
+        const auto mask {compare(x[index], y[index])}; // 成り立つ要素は全ビットが立つ
+
+        for (size_type lane {0}; lane < lanes; ++lane)
+        {
+          if (not mask[lane])
+          {
+            return false;
+          }
+        }
+#else
+        if (not compare(x[index], y[index]))
+        {
+          return false;
+        }
+#endif
+      }
+
+      for (auto index {whole * lanes}; index < lhs.size_; ++index)
+      {
+        if (not compare(lhs.data_.get()[index], rhs.data_.get()[index]))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+  public: // element-wise arithmetic
+    friend auto operator+(const packed_vector& lhs, const packed_vector& rhs)
+      -> packed_vector
+    {
+      return zip_<wrapping_block_type>(lhs, rhs, std::plus<void> {});
+    }
+
+    friend auto operator-(const packed_vector& lhs, const packed_vector& rhs)
+      -> packed_vector
+    {
+      return zip_<wrapping_block_type>(lhs, rhs, std::minus<void> {});
+    }
+
+    friend auto operator*(const packed_vector& lhs, const packed_vector& rhs)
+      -> packed_vector
+    {
+      return zip_<wrapping_block_type>(lhs, rhs, std::multiplies<void> {});
+    }
+
+    template <typename U = T, typename = typename std::enable_if<std::is_floating_point<U>::value>::type>
+    friend auto operator/(const packed_vector& lhs, const packed_vector& rhs)
+      -> packed_vector
+    {
+      return zip_<block_type>(lhs, rhs, std::divides<void> {});
+    }
+
+    // 要素の総和。浮動小数点数ではブロック内の要素毎に足し込むので、先頭から順に足した場合と丸めが異なりうる
+    auto sum() const noexcept
+      -> T
+    {
+      wrapping_block_type buffer {};
+
+      const auto* x {reinterpret_cast<const wrapping_block_type*>(data_.get())};
+
+      for (size_type index {0}, blocks {blocks_()}; index < blocks; ++index)
+      {
+        buffer += x[index];
+      }
+
+#if CORELISP_VECTOR_EXTENSIONS
+      wrapping_type result {};
+
+      for (size_type lane {0}; lane < lanes; ++lane)
+      {
+        result += buffer[lane];
+      }
+
+      return static_cast<T>(result);
+#else
+      return static_cast<T>(buffer);
+#endif
+    }
+
+    friend auto dot(const packed_vector& lhs, const packed_vector& rhs)
+      -> T
+    {
+      check_size_(lhs, rhs);
+
+      wrapping_block_type buffer {};
+
+      const auto* x {reinterpret_cast<const wrapping_block_type*>(lhs.data_.get())};
+      const auto* y {reinterpret_cast<const wrapping_block_type*>(rhs.data_.get())};
+
+      for (size_type index {0}, blocks {lhs.blocks_()}; index < blocks; ++index)
+      {
+        buffer += x[index] * y[index];
+      }
+
+#if CORELISP_VECTOR_EXTENSIONS
+      wrapping_type result {};
+
+      for (size_type lane {0}; lane < lanes; ++lane)
+      {
+        result += buffer[lane];
+      }
+
+      return static_cast<T>(result);
+#else
+      return static_cast<T>(buffer);
+#endif
+    }
+
+  public: // element-wise comparison（すべての要素で成り立つ場合に真）
+    friend bool operator==(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return (lhs.data_ == rhs.data_ and lhs.size_ == rhs.size_) or all_(lhs, rhs, std::equal_to<void> {});
+    }
+
+    friend bool operator!=(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return not (lhs == rhs);
+    }
+
+    friend bool operator<(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return all_(lhs, rhs, std::less<void> {});
+    }
+
+    friend bool operator<=(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return all_(lhs, rhs, std::less_equal<void> {});
+    }
+
+    friend bool operator>(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return all_(lhs, rhs, std::greater<void> {});
+    }
+
+    friend bool operator>=(const packed_vector& lhs, const packed_vector& rhs) noexcept
+    {
+      return all_(lhs, rhs, std::greater_equal<void> {});
+    }
+
+    friend auto operator<<(std::ostream& os, const packed_vector& v)
+      -> std::ostream&
+    {
+      os << (std::is_floating_point<T>::value ? "#f64(" : "#i64(");
+
+      for (auto iter {std::begin(v)}; iter != std::end(v); ++iter)
+      {
+        os << (iter != std::begin(v) ? " " : "") << number {*iter};
+      }
+
+      return os << ')';
+    }
+  };
+
+  using f64vector = packed_vector<flonum>;
+  using i64vector = packed_vector<fixnum>;
+} // namespace lisp
+
+
+namespace std
+{
+  template <typename T>
+  struct hash<lisp::packed_vector<T>>
+  {
+    auto operator()(const lisp::packed_vector<T>& v) const noexcept
+    {
+      return boost::hash_range(std::begin(v), std::end(v));
+    }
+  };
+} // namespace std
+
+
+#endif // INCLUDED_CORELISP_LISP_PACKED_VECTOR_HPP
@@ -0,0 +1,150 @@
+#ifndef INCLUDED_CORELISP_LISP_PROCEDURE_HPP
+#define INCLUDED_CORELISP_LISP_PROCEDURE_HPP
+
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <corelisp/lisp/symbol.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+namespace lisp
+{
+  // 親フレームへのリンクを持つ環境フレーム。スロットはフレーム本体の直後に置かれ、
+  // 関数呼び出し一回につき仮引数の数ちょうどの領域を一度だけ確保する
+  class alignas(vectored_cons_cells) frame
+  {
+    using cells_type = vectored_cons_cells;
+
+    mutable std::atomic<std::size_t> references_;
+
+  public:
+    const boost::intrusive_ptr<frame> parent;
+
+  private:
+    const std::size_t size_;
+
+    frame(const boost::intrusive_ptr<frame>& parent, std::size_t size) noexcept
+      : references_ {0},
+        parent {parent},
+        size_ {size}
+    {}
+
+    ~frame()
+    {
+      std::destroy_n((*this).data(), size_);
+    }
+
+  public:
+    static auto make(const boost::intrusive_ptr<frame>& parent, std::size_t size)
+      -> boost::intrusive_ptr<frame>
+    {
+      auto* memory {::operator new(sizeof(frame) + sizeof(cells_type) * size)};
+
+      auto* result {new (memory) frame {parent, size}};
+      std::uninitialized_default_construct_n((*result).data(), size);
+
+      return boost::intrusive_ptr<frame> {result};
+    }
+
+    auto data() noexcept
+      -> cells_type*
+    {
+      return reinterpret_cast<cells_type*>(this + 1);
+    }
+
+    auto size() const noexcept
+    {
+      return size_;
+    }
+
+    auto use_count() const noexcept
+    {
+      return references_.load(std::memory_order_relaxed);
+    }
+
+    auto& operator[](std::size_t index) noexcept
+    {
+      return (*this).data()[index];
+    }
+
+    auto& at(std::size_t depth) noexcept // 静的に解決済みの深さを辿るだけなので範囲検査はしない
+    {
+      auto* buffer {this};
+
+      while (depth--)
+      {
+        buffer = (*buffer).parent.get();
+      }
+
+      return *buffer;
+    }
+
+    friend void intrusive_ptr_add_ref(const frame* f) noexcept
+    {
+      (*f).references_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(const frame* f) noexcept
+    {
+      if ((*f).references_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        auto* buffer {const_cast<frame*>(f)};
+        buffer->~frame();
+        ::operator delete(buffer);
+      }
+    }
+  };
+
+  using environment = boost::intrusive_ptr<frame>; // トップレベルでは空
+
+  struct bytecode;
+
+  // 作った後に書き換わる、関数本体の状態（memoize の表など）。フレームとリストは作った後に
+  // 書き換えないので、参照の循環はこれを介してしか生じない。collector が辿れるよう、
+  // 所有するのは procedure::state だけにして、本体からは弱参照で引く
+  class mutable_state
+  {
+  public:
+    virtual ~mutable_state() = default;
+
+    // 保持している値を全て f に渡す
+    virtual void trace(const std::function<void (const vectored_cons_cells&)>& f) const = 0;
+
+    // 保持している値を捨てる。外から辿れない循環を断ち切るために呼ばれる
+    virtual void clear() = 0;
+
+    // 本体が (name function arguments...) で作ったものなら、name と function と arguments を f に渡す。
+    // イメージはこれを保存し、読み込み時に同じ呼び出しで作り直す
+    virtual void wrapper(const std::function<void (const symbol&, const vectored_cons_cells&, const vectored_cons_cells&)>&) const
+    {}
+  };
+
+  struct procedure
+  {
+    using node_type = std::function<vectored_cons_cells (const environment&)>;
+
+    std::size_t arity;
+    node_type body;
+    environment closure;
+
+    std::shared_ptr<const bytecode> code {}; // バイトコード実行系で生成された場合のみ
+
+    // 外側の lambda の仮引数名。イメージから復元する際に本体を再解析するために使う
+    std::shared_ptr<const std::vector<std::vector<symbol>>> scope {};
+
+    bool opaque {false}; // 本体が lambda 式を評価するだけのものでない（memoize など）。最適化で展開しない
+
+    std::shared_ptr<mutable_state> state {};
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_PROCEDURE_HPP
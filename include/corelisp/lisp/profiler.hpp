@@ -0,0 +1,359 @@
+#ifndef INCLUDED_CORELISP_LISP_PROFILER_HPP
+#define INCLUDED_CORELISP_LISP_PROFILER_HPP
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/symbol.hpp>
+
+
+namespace lisp
+{
+  // 呼び出し毎の回数、時間、確保回数を名前毎と呼び出し経路毎に集計する。
+  // 計測点（enter と exit の組）を差し込むのは evaluator の役目で、計測していない間は
+  // 評価器のどこからも呼ばれない。スタックはスレッド毎に持つので、pcall のワーカーからも呼べる
+  class profiler
+  {
+  public:
+    using clock_type = std::chrono::steady_clock;
+    using duration_type = typename clock_type::duration;
+
+    enum class kind_type
+    {
+      builtin, lambda
+    };
+
+    // そのスレッドでのそれまでの確保回数を返す関数。空なら確保は数えない
+    std::function<std::size_t ()> allocations {};
+
+  protected:
+    struct entry
+    {
+      std::string name;
+      kind_type kind;
+
+      std::size_t calls {0};
+      duration_type inclusive {}, exclusive {};
+      std::size_t inclusive_allocations {0}, exclusive_allocations {0};
+    };
+
+    struct node // 呼び出し経路の木
+    {
+      std::size_t calls {0};
+      duration_type exclusive {};
+      std::map<std::size_t, std::unique_ptr<node>> children {};
+    };
+
+    struct frame
+    {
+      std::size_t id;
+      node* path;
+
+      clock_type::time_point begin;
+      std::size_t allocations;
+
+      duration_type children {};
+      std::size_t children_allocations {0};
+    };
+
+    mutable std::mutex mutex_;
+
+    std::vector<entry> entries_ {{"(lambda)", kind_type::lambda}}; // 0 は名前のないクロージャ
+    std::unordered_map<const procedure*, std::size_t> procedures_ {};
+
+    node root_ {};
+
+    std::size_t generation_ {0}; // clear で進め、古いスレッド毎の状態を捨てさせる
+
+    static inline thread_local struct
+    {
+      const profiler* owner;
+      std::size_t generation;
+
+      std::vector<frame> stack;
+      std::vector<std::size_t> active; // id 毎の再帰の深さ。一番外側の呼び出しだけ包括時間に足す
+    } thread_ {nullptr, 0, {}, {}};
+
+    auto& thread_state_()
+    {
+      if (thread_.owner != this or thread_.generation != generation_)
+      {
+        thread_ = {this, generation_, {}, {}};
+      }
+
+      return thread_;
+    }
+
+    auto allocations_() const
+    {
+      return allocations ? allocations() : 0;
+    }
+
+  public:
+    profiler() = default;
+
+    profiler(const profiler&) = delete;
+    auto operator=(const profiler&) -> profiler& = delete;
+
+    // 計測を始める前に名前を登録する。同じ名前と種類には同じ番号を返す
+    auto define(const symbol& name, kind_type kind)
+      -> std::size_t
+    {
+      std::lock_guard lock {mutex_};
+
+      for (std::size_t id {0}; id < std::size(entries_); ++id)
+      {
+        if (entries_[id].kind == kind and entries_[id].name == name.name())
+        {
+          return id;
+        }
+      }
+
+      entries_.push_back({std::string {name.name()}, kind});
+      return std::size(entries_) - 1;
+    }
+
+    // 計測中のクロージャ本体。バイトコード実行系が呼び出し先を名前に引くのに使う
+    void define(const procedure* proc, std::size_t id)
+    {
+      std::lock_guard lock {mutex_};
+      procedures_.insert_or_assign(proc, id);
+    }
+
+    auto defined(const procedure* proc) const
+    {
+      std::lock_guard lock {mutex_};
+      return procedures_.count(proc) != 0;
+    }
+
+    // 計測中は procedures_ を書き換えないので、ロックなしで引く
+    auto identify(const procedure* proc) const noexcept
+      -> std::size_t
+    {
+      const auto iter {procedures_.find(proc)};
+      return iter != std::end(procedures_) ? iter->second : 0;
+    }
+
+    void enter(std::size_t id)
+    {
+      auto& state {thread_state_()};
+
+      const auto begin {clock_type::now()};
+      const auto allocations {allocations_()};
+
+      std::lock_guard lock {mutex_};
+
+      auto& children {(std::empty(state.stack) ? root_ : *state.stack.back().path).children};
+
+      auto& path {children[id]};
+
+      if (not path)
+      {
+        path = std::make_unique<node>();
+      }
+
+      state.stack.push_back({id, path.get(), begin, allocations});
+
+      if (std::size(state.active) <= id)
+      {
+        state.active.resize(id + 1);
+      }
+
+      ++state.active[id];
+    }
+
+    void exit()
+    {
+      auto& state {thread_state_()};
+
+      if (std::empty(state.stack)) // 計測の途中で clear された
+      {
+        return;
+      }
+
+      const auto end {clock_type::now()};
+      const auto allocations {allocations_()};
+
+      const auto f {state.stack.back()};
+      state.stack.pop_back();
+
+      const auto inclusive {end - f.begin};
+      const auto inclusive_allocations {allocations - f.allocations};
+
+      std::lock_guard lock {mutex_};
+
+      auto& e {entries_[f.id]};
+
+      ++e.calls;
+      e.exclusive += inclusive - f.children;
+      e.exclusive_allocations += inclusive_allocations - f.children_allocations;
+
+      if (--state.active[f.id] == 0)
+      {
+        e.inclusive += inclusive;
+        e.inclusive_allocations += inclusive_allocations;
+      }
+
+      ++(*f.path).calls;
+      (*f.path).exclusive += inclusive - f.children;
+
+      if (not std::empty(state.stack))
+      {
+        state.stack.back().children += inclusive;
+        state.stack.back().children_allocations += inclusive_allocations;
+      }
+    }
+
+    // このスレッドで入れ子になっている計測の数
+    auto depth()
+    {
+      return std::size(thread_state_().stack);
+    }
+
+    // 例外で抜けた計測を閉じる
+    void unwind(std::size_t depth)
+    {
+      while (depth < (*this).depth())
+      {
+        exit();
+      }
+    }
+
+    struct guard
+    {
+      profiler& profile;
+
+      guard(profiler& profile, std::size_t id)
+        : profile {profile}
+      {
+        profile.enter(id);
+      }
+
+      ~guard()
+      {
+        profile.exit();
+      }
+    };
+
+    // 集計とクロージャの登録を捨てる。名前の番号は保つ
+    void clear()
+    {
+      std::lock_guard lock {mutex_};
+
+      for (auto& each : entries_)
+      {
+        each = {each.name, each.kind};
+      }
+
+      procedures_.clear();
+      root_ = {};
+      ++generation_;
+    }
+
+    // 自己時間の長い順の表
+    void report(std::ostream& os) const
+    {
+      using namespace std::chrono;
+
+      std::lock_guard lock {mutex_};
+
+      std::vector<const entry*> sorted {};
+
+      for (const auto& each : entries_)
+      {
+        if (each.calls)
+        {
+          sorted.push_back(&each);
+        }
+      }
+
+      std::sort(std::begin(sorted), std::end(sorted), [](auto* lhs, auto* rhs)
+      {
+        return (*rhs).exclusive < (*lhs).exclusive;
+      });
+
+      const auto milliseconds = [](const duration_type& d)
+      {
+        return duration_cast<duration<double, std::milli>>(d).count();
+      };
+
+      os << std::right
+         << std::setw(12) << "calls"
+         << std::setw(14) << "incl (ms)"
+         << std::setw(14) << "excl (ms)";
+
+      if (allocations)
+      {
+        os << std::setw(14) << "incl allocs" << std::setw(14) << "excl allocs";
+      }
+
+      os << "  name\n";
+
+      for (const auto* each : sorted)
+      {
+        os << std::fixed << std::setprecision(3)
+           << std::setw(12) << (*each).calls
+           << std::setw(14) << milliseconds((*each).inclusive)
+           << std::setw(14) << milliseconds((*each).exclusive);
+
+        if (allocations)
+        {
+          os << std::setw(14) << (*each).inclusive_allocations << std::setw(14) << (*each).exclusive_allocations;
+        }
+
+        os << "  " << (*each).name << ((*each).kind == kind_type::builtin ? " [builtin]" : "") << "\n";
+      }
+
+      os << std::defaultfloat << std::flush;
+    }
+
+    // flamegraph.pl などが読む畳み込み形式。経路毎の自己時間をマイクロ秒で出力する
+    void collapse(std::ostream& os) const
+    {
+      std::lock_guard lock {mutex_};
+
+      std::string path {};
+
+      collapse_(os, root_, path);
+
+      os << std::flush;
+    }
+
+  protected:
+    void collapse_(std::ostream& os, const node& n, std::string& path) const
+    {
+      for (const auto& [id, child] : n.children)
+      {
+        const auto size {std::size(path)};
+
+        path += (size ? ";" : "") + entries_[id].name;
+
+        if (const auto us {std::chrono::duration_cast<std::chrono::microseconds>((*child).exclusive).count()}; us)
+        {
+          os << path << ' ' << us << '\n';
+        }
+
+        collapse_(os, *child, path);
+
+        path.resize(size);
+      }
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_PROFILER_HPP
@@ -2,48 +2,175 @@
 #define INCLUDED_CORELISP_LISP_READER_HPP
 
 
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+
 namespace lisp
 {
-  // XXX なんか違う、作りたかったのはコレジャナイ
-  template <typename CharType>
+  // 入力を大きなチャンク単位で読み込みながら括弧の深さを逐次追跡し、
+  // トップレベルの形式が閉じた時点でそのテキストを返すストリーミングリーダ。
+  // 走査済みの位置と深さは呼び出しを跨いで保持するので、入力を読み直すことはない
   class reader
-    : public std::basic_string<CharType>
   {
+    std::function<std::size_t (char*, std::size_t)> read_;
+
+    std::string buffer_;
+    std::size_t chunk_size_;
+
+    std::size_t scanned_  {0}; // buffer_ 中の走査済みの位置
+    std::size_t consumed_ {0}; // 返却済みの形式の末尾
+    std::size_t begin_    {std::string::npos}; // 読み途中の形式の先頭
+    std::size_t depth_    {0};
+
   public:
-    using char_type = CharType;
+    static constexpr std::size_t default_chunk_size {64 * 1024};
+
+    // 少なくとも一文字は待ち、残りは既にバッファされている分だけ読むので対話的な入力でも塞がらない
+    explicit reader(std::istream& is, std::size_t chunk_size = default_chunk_size)
+      : read_ {[&is](char* data, std::size_t size) -> std::size_t
+        {
+          if (is.peek() == std::istream::traits_type::eof())
+          {
+            return 0;
+          }
+          else if (const auto n {is.readsome(data, size)}; 0 < n)
+          {
+            return n;
+          }
+          else return is.get(*data), 1;
+        }},
+        chunk_size_ {chunk_size}
+    {}
+
+    explicit reader(int fd, std::size_t chunk_size = default_chunk_size)
+      : read_ {[fd](char* data, std::size_t size) -> std::size_t
+        {
+          while (true)
+          {
+            if (const auto n {::read(fd, data, size)}; 0 <= n)
+            {
+              return n;
+            }
+            else if (errno != EINTR)
+            {
+              throw std::runtime_error {"reader: read(2) failed"};
+            }
+          }
+        }},
+        chunk_size_ {chunk_size}
+    {}
 
-    enum class as // read as...
+    // 次のトップレベル形式。返したビューは次の呼び出しまで有効で、入力が尽きたら空を返す。
+    // 対応しない閉じ括弧は読み飛ばしてから、閉じ括弧が足りないまま入力が尽きた場合は読み途中の
+    // 形式を捨ててから例外を送出するので、捕まえて読み続けられる
+    auto operator()()
+      -> std::optional<std::string_view>
     {
-      getchar, getline
-    };
+      buffer_.erase(0, consumed_);
+      scanned_ -= consumed_;
 
-  public:
-    // やりたかったのはコンパイルタイムタグディスパッチだがどうしてこうなった
-    template <auto Dispatcher, typename... Ts>
-    decltype(auto) operator()(Ts&&... args)
+      if (begin_ != std::string::npos)
+      {
+        begin_ -= consumed_;
+      }
+
+      consumed_ = 0;
+
+      while (true)
+      {
+        for (; scanned_ < std::size(buffer_); ++scanned_)
+        {
+          const auto c {buffer_[scanned_]};
+
+          if (begin_ == std::string::npos)
+          {
+            if (std::isspace(static_cast<unsigned char>(c)))
+            {
+              continue;
+            }
+            else if (c == ')')
+            {
+              consumed_ = ++scanned_;
+              throw std::runtime_error {"reader: unexpected ')'"};
+            }
+
+            begin_ = scanned_;
+            depth_ = (c == '(');
+          }
+          else if (depth_ == 0) // トップレベルのアトムは区切り文字の直前で閉じる
+          {
+            if (std::isspace(static_cast<unsigned char>(c)) or c == '(' or c == ')')
+            {
+              return yield_(scanned_);
+            }
+          }
+          else if (c == '(')
+          {
+            ++depth_;
+          }
+          else if (c == ')' and --depth_ == 0)
+          {
+            return yield_(++scanned_);
+          }
+        }
+
+        if (not fill_())
+        {
+          if (begin_ == std::string::npos)
+          {
+            return std::nullopt;
+          }
+          else if (depth_ == 0)
+          {
+            return yield_(scanned_);
+          }
+
+          yield_(scanned_);
+          throw std::runtime_error {"reader: unexpected end of input"};
+        }
+      }
+    }
+
+    auto depth() const noexcept
     {
-      return read_<Dispatcher> {}(std::forward<Ts>(args)...);
+      return depth_;
     }
 
   protected:
-    template <auto Dispatcher, typename = void>
-    class read_;
+    bool fill_()
+    {
+      const auto size {std::size(buffer_)};
+      buffer_.resize(size + chunk_size_);
+
+      const auto n {read_(std::data(buffer_) + size, chunk_size_)};
+      buffer_.resize(size + n);
 
-    template <auto Dispatcher>
-    class read_<Dispatcher, typename std::enable_if<Dispatcher == as::getchar>::type>
+      return 0 < n;
+    }
+
+    auto yield_(std::size_t end) noexcept
+      -> std::string_view
     {
-    public:
-      auto operator()(std::istream& is) const noexcept(noexcept(is.get()))
-      {
-        return static_cast<char_type>(is.get());
-      }
-    };
+      const std::string_view form {std::data(buffer_) + begin_, end - begin_};
 
-    template <typename Dispatcher>
-    class read_<Dispatcher, typename std::enable_if<Dispatcher == >::type>
-  } static read;
+      consumed_ = end;
+      begin_ = std::string::npos;
+      depth_ = 0;
+
+      return form;
+    }
+  };
 } // namespace lisp
 
 
 #endif // INCLUDED_CORELISP_LISP_READER_HPP
-
@@ -0,0 +1,144 @@
+#ifndef INCLUDED_CORELISP_LISP_SYMBOL_HPP
+#define INCLUDED_CORELISP_LISP_SYMBOL_HPP
+
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+namespace lisp
+{
+  // インターン済みシンボル。識別子は読み込み時に一度だけ文字列ハッシュされ、
+  // 以降の比較とハッシュは整数IDのみで行う。
+  // 名前表はプロセスで一つだけ持ち、インタプリタ（とそのスレッド）の間で ID を共有する
+  class symbol
+  {
+  public:
+    using id_type = std::size_t;
+
+  private:
+    id_type id_;
+
+    struct table_type
+    {
+      std::deque<std::string> names; // 末尾への追加では要素が移動しないので、ビューのキーを安全に張れる
+      std::unordered_map<std::string_view, id_type> ids;
+
+      mutable std::shared_mutex mutex; // 追加は排他、参照は共有
+
+      table_type()
+        : names {""},
+          ids {{names.front(), 0}}
+      {}
+    };
+
+    static auto table()
+      -> table_type&
+    {
+      static table_type table {};
+      return table;
+    }
+
+    static auto intern(std::string_view name) // 既出の名前なら確保は発生しない
+      -> id_type
+    {
+      auto& table {symbol::table()};
+
+      {
+        std::shared_lock lock {table.mutex};
+
+        if (auto iter {table.ids.find(name)}; iter != std::end(table.ids))
+        {
+          return iter->second;
+        }
+      }
+
+      std::unique_lock lock {table.mutex};
+
+      if (auto iter {table.ids.find(name)}; iter != std::end(table.ids)) // 確認の間に他のスレッドが登録した
+      {
+        return iter->second;
+      }
+
+      table.names.emplace_back(name);
+      return table.ids.emplace(table.names.back(), std::size(table.names) - 1).first->second;
+    }
+
+  public: // constructors
+    constexpr symbol() noexcept
+      : id_ {0}
+    {}
+
+    symbol(std::string_view name)
+      : id_ {intern(name)}
+    {}
+
+    symbol(const std::string& name)
+      : symbol {std::string_view {name}}
+    {}
+
+    symbol(const char* name)
+      : symbol {std::string_view {name}}
+    {}
+
+  public: // accesses
+    constexpr auto id() const noexcept
+    {
+      return id_;
+    }
+
+    auto name() const
+      -> const std::string& // 要素は移動しないので、ロックを外した後も参照は有効
+    {
+      auto& table {symbol::table()};
+      std::shared_lock lock {table.mutex};
+      return table.names[id_];
+    }
+
+    constexpr explicit operator bool() const noexcept
+    {
+      return id_ != 0;
+    }
+
+  public: // operators
+    constexpr bool operator==(const symbol& rhs) const noexcept
+    {
+      return id_ == rhs.id_;
+    }
+
+    constexpr bool operator!=(const symbol& rhs) const noexcept
+    {
+      return id_ != rhs.id_;
+    }
+
+    friend auto operator<<(std::ostream& os, const symbol& s)
+      -> std::ostream&
+    {
+      return os << s.name();
+    }
+  };
+} // namespace lisp
+
+
+namespace std
+{
+  template <>
+  struct hash<lisp::symbol>
+  {
+    auto operator()(const lisp::symbol& s) const noexcept
+    {
+      return s.id();
+    }
+  };
+} // namespace std
+
+
+#endif // INCLUDED_CORELISP_LISP_SYMBOL_HPP
@@ -5,46 +5,59 @@
 #include <algorithm>
 #include <iterator>
 #include <locale>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 
 namespace lisp
 {
-  class tokenizer
-    : public std::vector<std::string>
+  // Token が std::string_view の場合、トークンは呼び出し側が所有するソース上の区間を指すだけで
+  // トークン毎の確保は一切行わない。ソースはトークン列（とそれから作る構文木の構築）より長生きすること
+  template <typename Token>
+  class basic_tokenizer
+    : public std::pmr::vector<Token>
   {
-    static auto tokenize_(const std::string& s)
-      -> std::vector<std::string>
+    using base_type = std::pmr::vector<Token>;
+
+  public:
+    using allocator_type = typename base_type::allocator_type;
+
+  protected:
+    static auto tokenize_(std::string_view s, const allocator_type& allocator)
+      -> base_type
     {
-      std::vector<std::string> buffer {};
+      base_type buffer {allocator};
 
       for (auto iter {find_begin(std::begin(s), std::end(s))}; iter != std::end(s); iter = find_begin(iter, std::end(s)))
       {
-        buffer.emplace_back(iter, is_round_brackets(*iter) ? std::next(iter, 1) : find_end(iter, std::end(s)));
-        std::advance(iter, std::size(buffer.back()));
+        const auto last {is_round_brackets(*iter) ? std::next(iter, 1) : find_end(iter, std::end(s))};
+        buffer.emplace_back(s.substr(std::distance(std::begin(s), iter), std::distance(iter, last)));
+        iter = last;
       }
 
       return buffer; // copy elision
     }
 
   public:
-    template <typename... Ts>
-    tokenizer(Ts&&... args)
-      : std::vector<std::string> {std::forward<Ts>(args)...}
+    explicit basic_tokenizer(const allocator_type& allocator = {})
+      : base_type {allocator}
     {}
 
-    tokenizer(const std::string& s)
-      : std::vector<std::string> {tokenize_(s)} // copy elision
+    // トークン列（とその文字列）は allocator（例えば呼び出し側のアリーナ）から確保される
+    basic_tokenizer(std::string_view s, const allocator_type& allocator = {})
+      : base_type {tokenize_(s, allocator)} // copy elision
     {}
 
-    auto& operator()(const std::string& s)
+    auto& operator()(std::string_view s)
     {
-      return *this = tokenize_(s);
+      static_cast<base_type&>(*this) = tokenize_(s, (*this).get_allocator());
+      return *this;
     }
 
-    friend auto operator<<(std::ostream& os, tokenizer& tokens)
+    friend auto operator<<(std::ostream& os, basic_tokenizer& tokens)
       -> std::ostream&
     {
       for (const auto& each : tokens)
@@ -80,7 +93,10 @@ namespace lisp
                return is_round_brackets(c) || std::isspace(c);
              });
     }
-  } static tokenize;
+  };
+
+  using tokenizer = basic_tokenizer<std::pmr::string>;
+  using token_views = basic_tokenizer<std::string_view>;
 } // namespace lisp
 
 
@@ -2,14 +2,24 @@
 #define INCLUDED_CORELISP_LISP_VECTORED_CONS_CELLS_HPP
 
 
+#include <cmath>
+#include <cstddef>
 #include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
+#include <variant>
 #include <vector>
 
+#include <boost/functional/hash.hpp>
+
+#include <corelisp/lisp/number.hpp>
+#include <corelisp/lisp/packed_vector.hpp>
+#include <corelisp/lisp/symbol.hpp>
 #include <corelisp/lisp/tokenizer.hpp>
 // #include <corelisp/utility/subrange_vector.hpp>
 #include <corelisp/utility/zip_iterator.hpp>
@@ -20,58 +30,345 @@
 
 namespace lisp
 {
+  struct procedure;
+
+  class constant_pool;
+
   // 気に入ってる名前だが英文的に正しく無さそうだし意味的にはフラットコンセルの方が良いかもしれぬ
   class vectored_cons_cells
-    : public std::vector<vectored_cons_cells>
+    : public std::pmr::vector<vectored_cons_cells>
   {
+    using base_type = std::pmr::vector<vectored_cons_cells>;
+
   public: // attirbutes
-    using value_type = std::string;
+    using symbol_type = symbol;
+    using boolean_type = bool;
+    using number_type = number;
+
+    // 空リスト（またはリスト）の場合は std::monostate。数値は fixnum と flonum のみ置き、多倍長の数は packed に置く
+    using value_type = std::variant<std::monostate, symbol_type, boolean_type, fixnum, flonum>;
     value_type value; // TODO to be constant
 
-    using scope_type = std::unordered_map<std::string, std::shared_ptr<vectored_cons_cells>>;
-    scope_type closure;
+    std::shared_ptr<const procedure> closure; // lambda の評価結果の場合のみ
+
+    // 詰めたベクトルと多倍長の数の場合のみ。value に含めると value の複製が自明でなくなり、全てのセルの複製が遅くなるので外に置く
+    using packed_type = std::variant<f64vector, i64vector, bignum, ratnum>;
+    std::shared_ptr<const packed_type> packed;
+
+    enum class tag
+    {
+      null, symbol, boolean, fixnum, flonum, pair, closure, f64vector, i64vector, bignum, ratnum // イメージに書く値なので末尾にだけ足す
+    };
+
+    using size_type = typename base_type::size_type;
+
+  protected:
+    // 自身の要素に続く、他のリストと共有された残りの要素（tail_ の offset_ 番目以降）。
+    // cdr は共有する位置をずらすだけ、cons は残りを複製せずに参照するだけで済む。
+    // offset_ は常に tail_ 自身の要素を指すよう正規化しておく
+    std::shared_ptr<const vectored_cons_cells> tail_;
+    size_type offset_ {0}, tail_size_ {0};
+
+    // constant_pool に登録された不変なリストのみ構造ハッシュを保持する（0 は未登録）。複製には引き継がない
+    std::size_t hash_ {0};
+
+    friend class constant_pool;
 
   public: // constructors
-    vectored_cons_cells(const value_type& value = "")
-      : value {value}
+    // アロケータを受け取るコンストラクタ群は std::pmr::vector による uses-allocator 構築用。
+    // 一回の読み込み全体をアリーナに確保し、まとめて解放できるようにする
+    using allocator_type = typename base_type::allocator_type;
+
+    vectored_cons_cells(const value_type& value = {}, const allocator_type& allocator = {})
+      : base_type {allocator},
+        value {value}
+    {}
+
+    explicit vectored_cons_cells(const allocator_type& allocator)
+      : base_type {allocator}
+    {}
+
+    vectored_cons_cells(const vectored_cons_cells& other)
+      : base_type(other),
+        value {other.value},
+        closure {other.closure},
+        packed {other.packed},
+        tail_ {other.tail_},
+        offset_ {other.offset_},
+        tail_size_ {other.tail_size_}
     {}
 
+    vectored_cons_cells(vectored_cons_cells&& other) noexcept
+      : base_type(std::move(other)),
+        value {std::move(other.value)},
+        closure {std::move(other.closure)},
+        packed {std::move(other.packed)},
+        tail_ {std::move(other.tail_)},
+        offset_ {std::exchange(other.offset_, 0)},
+        tail_size_ {std::exchange(other.tail_size_, 0)}
+    {}
+
+    vectored_cons_cells(const vectored_cons_cells& other, const allocator_type& allocator)
+      : base_type {other, allocator},
+        value {other.value},
+        closure {other.closure},
+        packed {other.packed},
+        tail_ {other.tail_},
+        offset_ {other.offset_},
+        tail_size_ {other.tail_size_}
+    {}
+
+    vectored_cons_cells(vectored_cons_cells&& other, const allocator_type& allocator)
+      : base_type {std::move(other), allocator},
+        value {std::move(other.value)},
+        closure {std::move(other.closure)},
+        packed {std::move(other.packed)},
+        tail_ {std::move(other.tail_)},
+        offset_ {std::exchange(other.offset_, 0)},
+        tail_size_ {std::exchange(other.tail_size_, 0)}
+    {}
+
+    template <typename T
+    , typename = typename std::enable_if<
+                            std::is_same<T, number_type>::value // bool などから暗黙に変換させない
+                          >::type>
+    vectored_cons_cells(const T& n)
+    {
+      (*this).assign_(n);
+    }
+
+    template <typename T>
+    vectored_cons_cells(const packed_vector<T>& v)
+      : packed {std::make_shared<const packed_type>(v)}
+    {}
+
+    // node の offset 番目以降の要素を複製せずに共有するリスト
+    vectored_cons_cells(const std::shared_ptr<const vectored_cons_cells>& node, size_type offset)
+    {
+      (*this).link_(node, offset);
+    }
+
     template <typename InputIterator
     , typename = typename std::enable_if<
-                            std::is_nothrow_constructible<
-                              decltype(value),
+                            std::is_constructible<
+                              std::string_view,
                               typename std::remove_reference<InputIterator>::type::value_type
                             >::value
                           >::type>
-    vectored_cons_cells(InputIterator&& begin, InputIterator&& end)
+    vectored_cons_cells(InputIterator&& begin, InputIterator&& end, const allocator_type& allocator = {})
+      : base_type {allocator}
     {
       if (std::distance(begin, end) != 0)
       {
         if (*begin != "(")
         {
-          (*this).value = *begin;
+          (*this).read(*begin);
         }
         else while (++begin != end && *begin != ")")
         {
-          emplace_back(begin, end);
+          if (emplace_back(begin, end); begin == end) // 閉じていないリストは入力の終わりで閉じる
+          {
+            break;
+          }
         }
       }
     }
 
-    template <template <typename...> typename SequenceContainer>
-    explicit vectored_cons_cells(const SequenceContainer<value_type>& tokens)
-      : vectored_cons_cells {std::begin(tokens), std::end(tokens)}
+    template <typename SequenceContainer
+    , typename = typename std::enable_if<
+                            std::is_constructible<
+                              std::string_view,
+                              typename SequenceContainer::value_type
+                            >::value
+                          >::type>
+    explicit vectored_cons_cells(const SequenceContainer& tokens, const allocator_type& allocator = {})
+      : vectored_cons_cells {std::begin(tokens), std::end(tokens), allocator}
     {}
 
-    template <template <typename...> typename SequenceContainer>
-    vectored_cons_cells(SequenceContainer<value_type>&& tokens)
-      : vectored_cons_cells {std::begin(tokens), std::end(tokens)}
-    {}
+    auto operator=(const vectored_cons_cells& other)
+      -> vectored_cons_cells&
+    {
+      base_type::operator=(other);
+      value = other.value;
+      closure = other.closure;
+      packed = other.packed;
+      tail_ = other.tail_;
+      offset_ = other.offset_;
+      tail_size_ = other.tail_size_;
+      hash_ = 0;
+      return *this;
+    }
+
+    auto operator=(vectored_cons_cells&& other)
+      -> vectored_cons_cells&
+    {
+      base_type::operator=(std::move(other));
+      value = std::move(other.value);
+      closure = std::move(other.closure);
+      packed = std::move(other.packed);
+      tail_ = std::move(other.tail_);
+      offset_ = std::exchange(other.offset_, 0);
+      tail_size_ = std::exchange(other.tail_size_, 0);
+      hash_ = 0;
+      return *this;
+    }
+
+    ~vectored_cons_cells()
+    {
+      // cons を重ねた長いリストを再帰的に解放するとスタックを使い切るので、唯一の所有者である間は繰り返しで外していく
+      while (tail_ and tail_.use_count() == 1)
+      {
+        tail_ = std::move(const_cast<vectored_cons_cells&>(*tail_).tail_);
+      }
+    }
+
+  public: // iterators
+    // 自身の要素から共有された残りへと区間を渡り歩く。共有された要素は書き換えられないので読み出し専用
+    class const_iterator
+    {
+      const vectored_cons_cells* current_ {nullptr};
+      const vectored_cons_cells* last_    {nullptr};
+      const vectored_cons_cells* owner_   {nullptr}; // 現在の区間を持つリスト。その tail_ が次の区間
+
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = vectored_cons_cells;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const vectored_cons_cells*;
+      using reference = const vectored_cons_cells&;
+
+      const_iterator() = default;
+
+      const_iterator(const vectored_cons_cells& owner, size_type offset) noexcept
+        : current_ {owner.base_type::data() + offset},
+          last_ {owner.base_type::data() + owner.base_type::size()},
+          owner_ {&owner}
+      {}
+
+      auto operator*() const noexcept
+        -> reference
+      {
+        return *current_;
+      }
+
+      auto operator->() const noexcept
+        -> pointer
+      {
+        return current_;
+      }
+
+      auto operator++() noexcept
+        -> const_iterator&
+      {
+        if (++current_ == last_)
+        {
+          *this = (*owner_).tail_ ? const_iterator {*(*owner_).tail_, (*owner_).offset_} : const_iterator {};
+        }
+
+        return *this;
+      }
+
+      auto operator++(int) noexcept
+      {
+        auto buffer {*this};
+        ++(*this);
+        return buffer;
+      }
+
+      bool operator==(const const_iterator& rhs) const noexcept
+      {
+        return current_ == rhs.current_;
+      }
+
+      bool operator!=(const const_iterator& rhs) const noexcept
+      {
+        return current_ != rhs.current_;
+      }
+    };
+
+    using iterator = const_iterator;
+
+    auto begin() const noexcept
+      -> const_iterator
+    {
+      if (not base_type::empty())
+      {
+        return {*this, 0};
+      }
+      else return tail_ ? const_iterator {*tail_, offset_} : const_iterator {};
+    }
+
+    auto end() const noexcept
+      -> const_iterator
+    {
+      return {};
+    }
+
+    auto size() const noexcept
+    {
+      return base_type::size() + tail_size_;
+    }
+
+    bool empty() const noexcept
+    {
+      return base_type::empty() and not tail_;
+    }
+
+    // 自身が持つ要素（共有された残りを含まない）と、共有された残り。collector が参照を数えるのに使う
+    auto owned() const noexcept
+      -> const base_type&
+    {
+      return *this;
+    }
+
+    auto& shared() const noexcept
+    {
+      return tail_;
+    }
+
+    auto operator[](size_type index) const noexcept
+      -> const vectored_cons_cells&
+    {
+      if (index < base_type::size())
+      {
+        return base_type::operator[](index);
+      }
+
+      index -= base_type::size();
+
+      const auto* node {tail_.get()};
+      auto offset {offset_};
+
+      while ((*node).base_type::size() - offset <= index)
+      {
+        index -= (*node).base_type::size() - offset;
+        offset = (*node).offset_;
+        node = (*node).tail_.get();
+      }
+
+      return (*node).base_type::operator[](offset + index);
+    }
+
+    auto at(size_type index) const
+      -> const vectored_cons_cells&
+    {
+      if (index < (*this).size())
+      {
+        return (*this)[index];
+      }
+      else throw std::out_of_range {"vectored_cons_cells::at"};
+    }
+
+    auto front() const noexcept
+      -> const vectored_cons_cells&
+    {
+      return *std::begin(*this);
+    }
 
   public: // accesses
     bool is_atom() const noexcept
     {
-      return std::empty(*this) and not std::empty(value);
+      return std::empty(*this) and (packed or not std::holds_alternative<std::monostate>(value));
     }
 
     friend auto atom(const vectored_cons_cells& e) noexcept
@@ -79,28 +376,298 @@ namespace lisp
       return e.is_atom();
     }
 
+    bool is_number() const noexcept
+    {
+      return std::empty(*this) and (std::holds_alternative<fixnum>(value) or std::holds_alternative<flonum>(value) or
+                                    (packed and (std::holds_alternative<bignum>(*packed) or std::holds_alternative<ratnum>(*packed))));
+    }
+
+    auto kind() const noexcept
+      -> tag
+    {
+      if (closure)
+      {
+        return tag::closure;
+      }
+      else if (not std::empty(*this))
+      {
+        return tag::pair;
+      }
+      else if (std::holds_alternative<symbol_type>(value))
+      {
+        return tag::symbol;
+      }
+      else if (std::holds_alternative<boolean_type>(value))
+      {
+        return tag::boolean;
+      }
+      else if (std::holds_alternative<fixnum>(value))
+      {
+        return tag::fixnum;
+      }
+      else if (std::holds_alternative<flonum>(value))
+      {
+        return tag::flonum;
+      }
+      else if (packed)
+      {
+        constexpr tag tags[] {tag::f64vector, tag::i64vector, tag::bignum, tag::ratnum}; // packed_type の選択肢の順
+        return tags[(*packed).index()];
+      }
+      else return tag::null;
+    }
+
+    // 数値リテラルや空リストの場合は空シンボル
+    auto identifier() const noexcept
+      -> symbol_type
+    {
+      const auto* s {std::get_if<symbol_type>(&value)};
+      return s ? *s : symbol_type {};
+    }
+
+    // 多倍長の数は複製せず、packed と所有権を共有する
+    auto as_number() const
+      -> number_type
+    {
+      if (std::empty(*this))
+      {
+        if (const auto* n {std::get_if<fixnum>(&value)}; n)
+        {
+          return *n;
+        }
+        else if (const auto* f {std::get_if<flonum>(&value)}; f)
+        {
+          return *f;
+        }
+        else if (const auto* n {packed ? std::get_if<bignum>(packed.get()) : nullptr}; n)
+        {
+          return *n;
+        }
+        else if (const auto* q {packed ? std::get_if<ratnum>(packed.get()) : nullptr}; q)
+        {
+          return *q;
+        }
+      }
+
+      throw std::invalid_argument {"not a number"};
+    }
+
+    // 値が T であればそれを指し、そうでなければ nullptr
+    template <typename T>
+    auto get_if() const noexcept
+      -> const T*
+    {
+      if constexpr (std::is_same<T, f64vector>::value or std::is_same<T, i64vector>::value)
+      {
+        return packed ? std::get_if<T>(packed.get()) : nullptr;
+      }
+      else return std::empty(*this) ? std::get_if<T>(&value) : nullptr;
+    }
+
+    template <typename T>
+    auto as() const
+      -> const T&
+    {
+      if (const auto* x {(*this).template get_if<T>()}; x)
+      {
+        return *x;
+      }
+      else throw std::invalid_argument {"unexpected type"};
+    }
+
+    // 構造ハッシュ。operator== で等しい値は等しいハッシュを持つ（数値は 1 と 1.0 を区別しない）。
+    // 登録済みのリストとその全体を指すリストでは保持済みの値を返す
+    auto hash() const noexcept
+      -> std::size_t
+    {
+      if (hash_)
+      {
+        return hash_;
+      }
+      else if (base_type::empty() and tail_ and offset_ == 0 and (*tail_).hash_)
+      {
+        return (*tail_).hash_;
+      }
+      else if (not std::empty(*this))
+      {
+        auto seed {std::size(*this)};
+
+        for (const auto& each : *this)
+        {
+          boost::hash_combine(seed, each.hash());
+        }
+
+        return seed;
+      }
+      else if (const auto* n {std::get_if<fixnum>(&value)}; n)
+      {
+        return std::hash<fixnum> {}(*n);
+      }
+      else if ((*this).is_number()) // 多倍長の数は浮動小数点数と近似値で比べるので、近似値で揃える
+      {
+        if (const auto f {(*this).as_number().inexact()}; std::trunc(f) == f and -0x1p63 <= f and f < 0x1p63) // 整数値なら対応する整数と揃える
+        {
+          return std::hash<fixnum> {}(static_cast<fixnum>(f));
+        }
+        else return std::hash<flonum> {}(f);
+      }
+      else if (packed)
+      {
+        return std::visit([](const auto& v) -> std::size_t
+        {
+          return std::hash<typename std::decay<decltype(v)>::type> {}(v);
+        }, *packed);
+      }
+      else return std::visit([](const auto& value) -> std::size_t
+      {
+        return std::hash<typename std::decay<decltype(value)>::type> {}(value);
+      }, value);
+    }
+
   public: // operation
     auto share() noexcept(noexcept(std::make_shared<vectored_cons_cells>(std::declval<vectored_cons_cells>())))
     {
       return std::make_shared<vectored_cons_cells>(*this);
     }
 
+    // 先頭を除いた残り。自身の要素は一度だけ共有領域へ移すので、以降の cdr は位置をずらすだけになる
+    friend auto cdr(vectored_cons_cells&& e)
+      -> vectored_cons_cells
+    {
+      vectored_cons_cells result {};
+
+      if (not std::empty(e))
+      {
+        const auto [node, offset] {std::move(e).detach_()};
+        result.link_(node, offset + 1);
+      }
+
+      return result;
+    }
+
+    // 残りが空リストかアトムの場合は一要素のリストになる
+    friend auto cons(vectored_cons_cells&& head, vectored_cons_cells&& rest)
+      -> vectored_cons_cells
+    {
+      vectored_cons_cells result {};
+      result.base_type::push_back(std::move(head));
+
+      if (not std::empty(rest))
+      {
+        const auto [node, offset] {std::move(rest).detach_()};
+        result.link_(node, offset);
+      }
+
+      return result;
+    }
+
+  protected:
+    // 自身を共有可能な区間に変える。自身の要素を持たなければ既存の共有部分をそのまま返す
+    auto detach_() &&
+      -> std::pair<std::shared_ptr<const vectored_cons_cells>, size_type>
+    {
+      if (base_type::empty())
+      {
+        return {std::move(tail_), offset_};
+      }
+      else return {std::make_shared<vectored_cons_cells>(std::move(*this)), 0};
+    }
+
+    void link_(std::shared_ptr<const vectored_cons_cells> node, size_type offset)
+    {
+      while (node and (*node).base_type::size() <= offset)
+      {
+        offset = offset - (*node).base_type::size() + (*node).offset_;
+        node = (*node).tail_;
+      }
+
+      if (node)
+      {
+        tail_size_ = (*node).base_type::size() + (*node).tail_size_ - offset;
+        tail_ = std::move(node);
+        offset_ = offset;
+      }
+      else
+      {
+        tail_ = nullptr;
+        offset_ = tail_size_ = 0;
+      }
+    }
+
+  protected:
+    void assign_(const number_type& n)
+    {
+      if (const auto* x {std::get_if<fixnum>(&n)}; x)
+      {
+        value = *x;
+      }
+      else if (const auto* x {std::get_if<flonum>(&n)}; x)
+      {
+        value = *x;
+      }
+      else if (const auto* x {std::get_if<bignum>(&n)}; x)
+      {
+        packed = std::make_shared<const packed_type>(*x);
+      }
+      else packed = std::make_shared<const packed_type>(std::get<ratnum>(n));
+    }
+
+    void read(std::string_view token)
+    {
+      if (token == "true" or token == "false")
+      {
+        value = token == "true";
+      }
+      else if (number_type buffer {}; number_type::read(token, buffer))
+      {
+        (*this).assign_(buffer);
+      }
+      else value = symbol_type {token};
+    }
+
   public: // operators
-    // TODO
-    // 真偽値型への暗黙キャスト演算子オーバーロードがあると面白いかも
-    // オペレータnull?を内部で呼ぶ感じで
+    // 偽とみなすのは false と空リストのみ
+    explicit operator bool() const noexcept
+    {
+      if (const auto* b {std::get_if<boolean_type>(&value)}; b and std::empty(*this))
+      {
+        return *b;
+      }
+      else return not (std::empty(*this) and std::holds_alternative<std::monostate>(value) and not packed);
+    }
 
-    bool operator!=(const vectored_cons_cells& rhs) const noexcept
+    bool operator!=(const vectored_cons_cells& rhs) const
     {
       if (&(*this) == &rhs) // アドレスが等しい場合は即座に比較終了
       {
         return false;
       }
+      else if ((*this).is_number() and rhs.is_number()) // 1 と 1.0 は等しい
+      {
+        return (*this).as_number() != rhs.as_number();
+      }
+
+      // 共有された同じ要素列を指していれば等しく、登録済みのリストの全体同士で保持済みのハッシュが異なれば等しくない
+      if (base_type::empty() and rhs.base_type::empty() and tail_ and rhs.tail_ and (*this).value == rhs.value)
+      {
+        if (tail_ == rhs.tail_ and offset_ == rhs.offset_)
+        {
+          return false;
+        }
+        else if (offset_ == 0 and rhs.offset_ == 0 and (*tail_).hash_ and (*rhs.tail_).hash_ and (*tail_).hash_ != (*rhs.tail_).hash_)
+        {
+          return true;
+        }
+      }
 
       if (std::size(*this) != std::size(rhs) or (*this).value != rhs.value)
       {
         return true;
       }
+      else if (packed != rhs.packed and (not packed or not rhs.packed or *packed != *rhs.packed))
+      {
+        return true;
+      }
 
       for(auto iter {utility::zip_begin(*this, rhs)}; iter != utility::zip_end(*this, rhs); ++iter)
       {
@@ -113,7 +680,7 @@ namespace lisp
       return false;
     }
 
-    bool operator==(const vectored_cons_cells& rhs) const noexcept
+    bool operator==(const vectored_cons_cells& rhs) const
     {
       return !(*this != rhs);
     }
@@ -121,20 +688,54 @@ namespace lisp
     friend auto operator<<(std::ostream& os, const vectored_cons_cells& e)
       -> std::ostream&
     {
-      if (not e.is_atom())
+      if (e.is_number())
+      {
+        return os << e.as_number();
+      }
+      else if (e.packed)
+      {
+        return std::visit([&](const auto& v) -> std::ostream& { return os << v; }, *e.packed);
+      }
+      else if (not e.is_atom())
       {
         os <<  '(';
-        for (const auto& each : e)
+        for (auto iter {std::begin(e)}; iter != std::end(e); ++iter)
         {
-          os << each << (&each != &e.back() ? " " : "");
+          os << (iter != std::begin(e) ? " " : "") << *iter;
         }
         return os << ')';
       }
-      else return os << e.value;
+      else return std::visit([&](const auto& value) -> std::ostream&
+      {
+        using type = typename std::decay<decltype(value)>::type;
+
+        if constexpr (std::is_same<type, boolean_type>::value)
+        {
+          return os << (value ? "true" : "false");
+        }
+        else if constexpr (std::is_same<type, std::monostate>::value)
+        {
+          return os << "()";
+        }
+        else return os << value;
+      }, e.value);
     }
-  } static true_value {"true"}, false_value;
+  } static const true_value {true}, false_value {false};
 } // namespace lisp
 
 
+namespace std
+{
+  template <>
+  struct hash<lisp::vectored_cons_cells>
+  {
+    auto operator()(const lisp::vectored_cons_cells& e) const noexcept
+    {
+      return e.hash();
+    }
+  };
+} // namespace std
+
+
 #endif // INCLUDED_CORELISP_LISP_VECTORED_CONS_CELLS_HPP
 
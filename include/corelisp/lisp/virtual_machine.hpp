@@ -0,0 +1,426 @@
+#ifndef INCLUDED_CORELISP_LISP_VIRTUAL_MACHINE_HPP
+#define INCLUDED_CORELISP_LISP_VIRTUAL_MACHINE_HPP
+
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <corelisp/lisp/analyzer.hpp>
+#include <corelisp/lisp/compiler.hpp>
+#include <corelisp/lisp/procedure.hpp>
+#include <corelisp/lisp/profiler.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+
+
+// GCC/Clang ではラベルのアドレスによる直接スレッディングで命令を振り分ける
+#if defined(__GNUC__) && !defined(CORELISP_NO_COMPUTED_GOTO)
+#define CORELISP_COMPUTED_GOTO 1
+#else
+#define CORELISP_COMPUTED_GOTO 0
+#endif
+
+
+namespace lisp
+{
+  // バイトコード実行系。環境フレームは木構造評価器と共通なので、
+  // 互いのクロージャをそのまま呼び出せる
+  class virtual_machine
+  {
+    using cells_type = vectored_cons_cells;
+    using number_type = typename cells_type::number_type;
+    using word_type = typename bytecode::word_type;
+
+    using primitives_type = typename analyzer::primitives_type;
+    using globals_type = typename analyzer::globals_type;
+
+    primitives_type& primitives_;
+    globals_type& globals_;
+
+    struct activation
+    {
+      std::shared_ptr<const bytecode> code;
+      const word_type* pc;
+      environment env;
+    };
+
+  public:
+    // 空でなければ、バイトコード同士の呼び出しも計測する版の命令ループで実行する
+    profiler* profiling {nullptr};
+
+    virtual_machine(primitives_type& primitives, globals_type& globals)
+      : primitives_ {primitives},
+        globals_ {globals}
+    {}
+
+    auto operator()(std::shared_ptr<const bytecode> code, environment env = nullptr)
+      -> cells_type
+    {
+      if (not profiling)
+      {
+        return execute_<false>(std::move(code), std::move(env), 0);
+      }
+
+      const auto depth {(*profiling).depth()};
+
+      try
+      {
+        return execute_<true>(std::move(code), std::move(env), depth);
+      }
+      catch (...)
+      {
+        (*profiling).unwind(depth);
+        throw;
+      }
+    }
+
+  protected:
+    // 計測する版では、呼び出しで入った起動記録毎に一つ計測を開く。この実行の最外の起動記録は
+    // 呼び出し元が計測済みなので、末尾呼び出しで置き換わった後（base より深い）だけ閉じる
+    template <bool Profiling>
+    auto execute_(std::shared_ptr<const bytecode> code, environment env, std::size_t base)
+      -> cells_type
+    {
+      std::vector<cells_type> stack {};
+      stack.reserve(64);
+
+      std::vector<activation> calls {};
+
+      const auto* pc {std::data((*code).code)};
+
+      const auto pop = [&]()
+      {
+        auto buffer {std::move(stack.back())};
+        stack.pop_back();
+        return buffer;
+      };
+
+      const auto arguments = [&](std::size_t n)
+      {
+        analyzer::arguments_type args {std::make_move_iterator(std::end(stack) - n), std::make_move_iterator(std::end(stack))};
+        stack.resize(std::size(stack) - n);
+        return args;
+      };
+
+      const auto bind = [&](const procedure& proc, std::size_t n)
+      {
+        if (n != proc.arity)
+        {
+          throw std::invalid_argument {"wrong number of arguments"};
+        }
+
+        auto callee {frame::make(proc.closure, n)};
+        std::move(std::end(stack) - n, std::end(stack), (*callee).data());
+        stack.resize(std::size(stack) - n);
+        return callee;
+      };
+
+      // 木構造評価器のクロージャとビルトインの呼び出し。結果は関数の位置に置く
+      const auto invoke = [&](std::size_t n, word_type c)
+      {
+        if (const auto proc {(*(std::end(stack) - n - 1)).closure}; proc)
+        {
+          auto callee {bind(*proc, n)};
+          stack.back() = analyzer::call(proc, std::move(callee));
+        }
+        else if (auto* entry {(*code).callees[c].find(primitives_, stack[std::size(stack) - n - 1].identifier())}; entry)
+        {
+          auto args {arguments(n)};
+          stack.back() = entry->second(args);
+        }
+        else throw std::invalid_argument {"not applicable"};
+      };
+
+      const auto primitive = [&](word_type k, std::size_t n)
+      {
+        auto args {arguments(n)};
+        stack.push_back((*(*code).primitives[k])(args));
+      };
+
+      const auto number = [&](auto&& f, word_type k)
+      {
+        auto& lhs {*(std::end(stack) - 2)};
+        auto& rhs {*(std::end(stack) - 1)};
+
+        if (const auto* x {lhs.template get_if<fixnum>()}, * y {rhs.template get_if<fixnum>()}; x and y) // 多倍長の数を扱う分岐を畳めるよう、fixnum であることを見せておく
+        {
+          lhs = cells_type {f(number_type {*x}, number_type {*y})};
+          stack.pop_back();
+        }
+        else if (lhs.is_number() and rhs.is_number())
+        {
+          lhs = cells_type {f(lhs.as_number(), rhs.as_number())};
+          stack.pop_back();
+        }
+        else primitive(k, 2);
+      };
+
+#if CORELISP_COMPUTED_GOTO
+      static const void* const labels[]
+      {
+        &&label_constant, &&label_load_local, &&label_load_global, &&label_define, &&label_closure,
+        &&label_branch, &&label_jump, &&label_guard, &&label_call, &&label_tail_call, &&label_primitive,
+        &&label_add, &&label_subtract, &&label_multiply, &&label_divide,
+        &&label_equal, &&label_less, &&label_less_equal, &&label_greater, &&label_greater_equal,
+        &&label_return_
+      };
+
+      // ラベルのアドレスへの goto はスコープを抜けてもデストラクタを呼ばないので、
+      // 各命令の本体では CORELISP_NEXT の時点で破棄が必要な局所変数を生かしておかないこと
+      #define CORELISP_CASE(NAME) label_##NAME:
+      #define CORELISP_NEXT() goto *labels[*pc++]
+
+      CORELISP_NEXT();
+#else
+      #define CORELISP_CASE(NAME) case instruction::NAME:
+      #define CORELISP_NEXT() continue
+
+      while (true) switch (static_cast<instruction>(*pc++))
+      {
+#endif
+      CORELISP_CASE(constant)
+      {
+        stack.push_back((*code).constants[*pc++]);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(load_local)
+      {
+        const auto depth {*pc++}, index {*pc++};
+        stack.push_back((*env).at(depth)[index]);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(load_global) // 未束縛のシンボルはそれ自身に評価される
+      {
+        const auto& global {(*code).globals[*pc++]};
+        const auto* entry {global.cache.find(globals_, global.name.identifier())};
+        stack.push_back(entry ? (*entry).value() : global.name);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(define)
+      {
+        const auto& name {(*code).constants[*pc++]};
+        stack.back() = globals_.insert_or_assign(name.identifier(), stack.back()).value();
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(closure)
+      {
+        const auto& function {(*code).functions[*pc++]};
+
+        stack.emplace_back((*function).source, 0);
+
+        {
+          environment closure {std::empty(*(*function).scope) ? nullptr : env};
+
+          if (const auto& captures {(*function).captures}; not std::empty(captures))
+          {
+            closure = frame::make(nullptr, std::size(captures));
+
+            for (std::size_t index {0}; index < std::size(captures); ++index)
+            {
+              (*closure)[index] = (*env).at(captures[index].first)[captures[index].second];
+            }
+          }
+
+          stack.back().closure = std::make_shared<procedure>(procedure {(*function).arity, [this, function](const environment& env)
+          {
+            return (*this)(function, env);
+          }, std::move(closure), function, (*function).scope});
+        }
+
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(branch)
+      {
+        const auto target {*pc++};
+
+        if (not pop())
+        {
+          pc = std::data((*code).code) + target;
+        }
+
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(jump)
+      {
+        pc = std::data((*code).code) + *pc;
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(guard)
+      {
+        const auto& global {(*code).globals[*pc++]};
+        const auto& expected {(*code).constants[*pc++]};
+        const auto target {*pc++};
+
+        if (const auto* entry {global.cache.find(globals_, global.name.identifier())}; not entry or (*entry).value().closure != expected.closure)
+        {
+          pc = std::data((*code).code) + target;
+        }
+
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(call)
+      {
+        const auto n {*pc++}, c {*pc++};
+
+        if (const auto proc {(*(std::end(stack) - n - 1)).closure}; proc and (*proc).code)
+        {
+          if (analyzer::max_depth <= std::size(calls))
+          {
+            throw std::runtime_error {"recursion too deep"};
+          }
+
+          auto callee {bind(*proc, n)};
+          stack.pop_back();
+
+          calls.push_back({std::move(code), pc, std::move(env)});
+
+          code = (*proc).code;
+          pc = std::data((*code).code);
+          env = std::move(callee);
+
+          if constexpr (Profiling)
+          {
+            (*profiling).enter((*profiling).identify(proc.get()));
+          }
+        }
+        else invoke(n, c);
+
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(tail_call) // バイトコード同士なら現在の起動記録を再利用する
+      {
+        const auto n {*pc++}, c {*pc++};
+
+        if (const auto proc {(*(std::end(stack) - n - 1)).closure}; proc and (*proc).code)
+        {
+          auto callee {bind(*proc, n)};
+          stack.pop_back();
+
+          code = (*proc).code;
+          pc = std::data((*code).code);
+          env = std::move(callee);
+
+          if constexpr (Profiling)
+          {
+            if (not std::empty(calls) or base < (*profiling).depth())
+            {
+              (*profiling).exit();
+            }
+
+            (*profiling).enter((*profiling).identify(proc.get()));
+          }
+        }
+        else invoke(n, c);
+
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(primitive)
+      {
+        const auto k {*pc++}, n {*pc++};
+        primitive(k, n);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(add)
+      {
+        number(std::plus<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(subtract)
+      {
+        number(std::minus<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(multiply)
+      {
+        number(std::multiplies<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(divide)
+      {
+        number(std::divides<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(equal)
+      {
+        number(std::equal_to<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(less)
+      {
+        number(std::less<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(less_equal)
+      {
+        number(std::less_equal<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(greater)
+      {
+        number(std::greater<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(greater_equal)
+      {
+        number(std::greater_equal<void> {}, *pc++);
+        CORELISP_NEXT();
+      }
+
+      CORELISP_CASE(return_)
+      {
+        if constexpr (Profiling)
+        {
+          if (not std::empty(calls) or base < (*profiling).depth())
+          {
+            (*profiling).exit();
+          }
+        }
+
+        if (std::empty(calls))
+        {
+          return pop();
+        }
+
+        code = std::move(calls.back().code);
+        pc = calls.back().pc;
+        env = std::move(calls.back().env);
+        calls.pop_back();
+
+        CORELISP_NEXT();
+      }
+#if !CORELISP_COMPUTED_GOTO
+      }
+#endif
+
+      #undef CORELISP_CASE
+      #undef CORELISP_NEXT
+    }
+  };
+} // namespace lisp
+
+
+#endif // INCLUDED_CORELISP_LISP_VIRTUAL_MACHINE_HPP
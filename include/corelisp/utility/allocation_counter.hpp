@@ -0,0 +1,79 @@
+#ifndef INCLUDED_CORELISP_UTILITY_ALLOCATION_COUNTER_HPP
+#define INCLUDED_CORELISP_UTILITY_ALLOCATION_COUNTER_HPP
+
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+// 大域の operator new を置き換えて、スレッド毎の確保回数と量を数える。
+// 置き換えはプログラムに一つだけなので、実行ファイル一つにつき一つの翻訳単位からのみ include すること
+namespace utility
+{
+  inline thread_local std::size_t allocation_count {0}, allocated_bytes_count {0};
+
+  // このスレッドでそれまでに確保した回数
+  inline auto allocations() noexcept
+  {
+    return allocation_count;
+  }
+
+  inline auto allocated_bytes() noexcept
+  {
+    return allocated_bytes_count;
+  }
+
+  namespace detail
+  {
+    inline auto allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+      -> void*
+    {
+      ++allocation_count;
+      allocated_bytes_count += size;
+
+      void* p {alignment <= alignof(std::max_align_t) ? std::malloc(size ? size : 1)
+                                                      : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)};
+
+      if (not p)
+      {
+        throw std::bad_alloc {};
+      }
+
+      return p;
+    }
+  } // namespace detail
+} // namespace utility
+
+void* operator new(std::size_t size)
+{
+  return utility::detail::allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  return utility::detail::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+
+#endif // INCLUDED_CORELISP_UTILITY_ALLOCATION_COUNTER_HPP
@@ -0,0 +1,279 @@
+#ifndef INCLUDED_CORELISP_UTILITY_THREAD_POOL_HPP
+#define INCLUDED_CORELISP_UTILITY_THREAD_POOL_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace utility
+{
+  // ワークスティーリングのスレッドプール。各ワーカーは自分の両端キューの末尾から仕事を取り、
+  // 空なら他のキューの先頭から盗む。完了を待つスレッドも仕事を手伝うので、
+  // 並列に実行中の仕事がさらに並列呼び出しを入れ子にしても詰まらない。
+  // ワーカーは最初に並列実行を要求されるまで起動しない
+  class thread_pool
+  {
+  public:
+    using task_type = std::function<void ()>;
+
+  protected:
+    struct queue
+    {
+      std::mutex mutex;
+      std::deque<task_type> tasks;
+    };
+
+    const std::size_t size_;
+
+    std::vector<std::unique_ptr<queue>> queues_; // 末尾はワーカー以外のスレッドが投入する仕事用
+    std::vector<std::thread> workers_;
+
+    std::once_flag started_;
+
+    std::atomic<std::size_t> pending_ {0};
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ {false};
+
+    static inline thread_local struct
+    {
+      const thread_pool* pool;
+      std::size_t index;
+    } current_ {nullptr, 0};
+
+  public:
+    // 呼び出し側のスレッドも仕事をするので、既定ではコア数より一つ少なく起動する
+    static auto hardware_workers() noexcept
+      -> std::size_t
+    {
+      return std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    }
+
+    explicit thread_pool(std::size_t size = hardware_workers())
+      : size_ {size}
+    {
+      for (std::size_t index {0}; index <= size_; ++index)
+      {
+        queues_.push_back(std::make_unique<queue>());
+      }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    auto operator=(const thread_pool&) -> thread_pool& = delete;
+
+    ~thread_pool()
+    {
+      {
+        std::lock_guard lock {mutex_};
+        stopping_ = true;
+      }
+
+      ready_.notify_all();
+
+      for (auto& each : workers_)
+      {
+        each.join();
+      }
+    }
+
+    auto size() const noexcept
+    {
+      return size_;
+    }
+
+    static constexpr std::size_t spin_count {64}; // 盗める仕事がない時に、眠る前に譲る回数
+
+    // f(0), ..., f(n - 1) を並列に呼び出し、すべて終わるまで待つ。
+    // 例外は全員の終了を待ってから、最初に捕まえたものを送出する。
+    // 待つ間は盗める仕事を手伝い、なければ少し譲ってから最後の仕事の完了を待って眠る
+    template <typename F>
+    void parallel_for(std::size_t n, F&& f)
+    {
+      std::atomic<std::size_t> remaining {n};
+
+      std::mutex mutex {};
+      std::condition_variable done {};
+      std::exception_ptr error {nullptr};
+
+      const auto run = [&](std::size_t index)
+      {
+        try
+        {
+          f(index);
+        }
+        catch (...)
+        {
+          std::lock_guard lock {mutex};
+
+          if (not error)
+          {
+            error = std::current_exception();
+          }
+        }
+
+        std::lock_guard lock {mutex}; // 待つ側はロックを取ってから戻るので、通知し終えるまで mutex と done は生きている
+
+        if (remaining.fetch_sub(1, std::memory_order_release) == 1)
+        {
+          done.notify_all();
+        }
+      };
+
+      if (size_ == 0 or n < 2)
+      {
+        for (std::size_t index {0}; index < n; ++index)
+        {
+          run(index);
+        }
+      }
+      else
+      {
+        std::call_once(started_, [this]() { start_(); });
+
+        for (std::size_t index {1}; index < n; ++index)
+        {
+          push_([&run, index]() { run(index); });
+        }
+
+        run(0);
+
+        for (std::size_t idle {0}; remaining.load(std::memory_order_acquire); )
+        {
+          if (run_one_())
+          {
+            idle = 0;
+          }
+          else if (++idle < spin_count)
+          {
+            std::this_thread::yield();
+          }
+          else // 入れ子の並列呼び出しが積んだ仕事も手伝えるよう、時々起きて見に行く
+          {
+            std::unique_lock lock {mutex};
+
+            done.wait_for(lock, std::chrono::milliseconds {1}, [&]()
+            {
+              return remaining.load(std::memory_order_acquire) == 0 or pending_.load(std::memory_order_acquire);
+            });
+          }
+        }
+      }
+
+      std::lock_guard lock {mutex}; // 最後に終えた仕事が通知を終えるのを待つ
+
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+    }
+
+  protected:
+    void start_()
+    {
+      for (std::size_t index {0}; index < size_; ++index)
+      {
+        workers_.emplace_back([this, index]()
+        {
+          current_ = {this, index};
+
+          while (true)
+          {
+            if (run_one_())
+            {
+              continue;
+            }
+
+            std::unique_lock lock {mutex_};
+
+            ready_.wait(lock, [this]()
+            {
+              return stopping_ or pending_.load(std::memory_order_acquire);
+            });
+
+            if (stopping_)
+            {
+              return;
+            }
+          }
+        });
+      }
+    }
+
+    auto own_() const noexcept
+      -> std::size_t
+    {
+      return current_.pool == this ? current_.index : size_;
+    }
+
+    void push_(task_type&& task)
+    {
+      {
+        auto& q {*queues_[own_()]};
+        std::lock_guard lock {q.mutex};
+        q.tasks.push_back(std::move(task));
+      }
+
+      pending_.fetch_add(1, std::memory_order_release);
+
+      {
+        std::lock_guard lock {mutex_}; // 待ちに入る直前のワーカーに通知を取りこぼさせない
+      }
+
+      ready_.notify_one();
+    }
+
+    // 自分のキューの末尾（最後に積んだ仕事）を優先し、なければ他のキューの先頭から盗む
+    bool run_one_()
+    {
+      const auto own {own_()};
+
+      for (std::size_t offset {0}; offset < std::size(queues_); ++offset)
+      {
+        auto& q {*queues_[(own + offset) % std::size(queues_)]};
+
+        task_type task {};
+
+        {
+          std::lock_guard lock {q.mutex};
+
+          if (std::empty(q.tasks))
+          {
+            continue;
+          }
+          else if (offset == 0)
+          {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+          }
+          else
+          {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+          }
+        }
+
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        return true;
+      }
+
+      return false;
+    }
+  };
+} // namespace utility
+
+
+#endif // INCLUDED_CORELISP_UTILITY_THREAD_POOL_HPP
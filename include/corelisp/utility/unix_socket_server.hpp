@@ -0,0 +1,385 @@
+#ifndef INCLUDED_CORELISP_UTILITY_UNIX_SOCKET_SERVER_HPP
+#define INCLUDED_CORELISP_UTILITY_UNIX_SOCKET_SERVER_HPP
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace utility
+{
+  // Unix ドメインソケットで長さ付きの要求を受け、handler の結果を要求の順に返す。
+  //   要求: 本体の長さ (u32) | 本体
+  //   応答: 本体の長さ (u32) | 状態 (u8) | handler の実行時間のナノ秒 (u64) | 本体
+  // 整数はビッグエンディアン。状態は handler が失敗を報告したか例外を送出した要求で 1、それ以外で 0 で、
+  // クライアントは本体の文字列を解析せずに失敗を見分けられる。例外の場合はその説明を本体として返して続ける。
+  // 一つのスレッドで poll(2) し、届いた要求を届いた順に処理するので handler は同時に呼ばれない。
+  // クライアントは応答を待たずに要求を続けて送ってよい（パイプライン化）。
+  // 応答は書き込めるまで接続毎に溜め、溜まりすぎた接続からは読まないので、
+  // 応答を読まないクライアントが他の接続を止めることも、メモリを使い切ることもない
+  class unix_socket_server
+  {
+  public:
+    enum class status : std::uint8_t
+    {
+      success = 0,
+      failure = 1,
+    };
+
+    struct response_type
+    {
+      std::string body {};
+      status state {status::success};
+    };
+
+    using handler_type = std::function<response_type (std::string_view)>;
+
+    static constexpr std::uint32_t max_request_size {64 * 1024 * 1024}; // これを超える要求を送った接続は切る
+    static constexpr std::size_t max_pending_output {1024 * 1024};     // これより溜まった接続からは読まない
+
+  protected:
+    struct connection
+    {
+      int fd;
+      std::string input {}, output {};
+      bool closing {false}; // 相手が書き終えた。溜まった応答を書き終えたら閉じる
+    };
+
+    const std::string path_;
+
+    int listener_ {-1};
+    int wakeup_[2] {-1, -1}; // stop() からの通知用の自己パイプ
+
+    std::vector<connection> connections_ {};
+
+  public:
+    // 残っているソケットファイルは、接続できなければ前のプロセスの残骸とみなして消す
+    explicit unix_socket_server(const std::string& path)
+      : path_ {path}
+    {
+      ::sockaddr_un address {};
+      address.sun_family = AF_UNIX;
+
+      if (sizeof(address.sun_path) <= std::size(path))
+      {
+        throw std::system_error {ENAMETOOLONG, std::generic_category(), "unix_socket_server: " + path};
+      }
+
+      std::memcpy(address.sun_path, path.c_str(), std::size(path) + 1);
+
+      const auto bind = [&]()
+      {
+        return ::bind(listener_, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) == 0;
+      };
+
+      if ((listener_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 or ::pipe2(wakeup_, O_NONBLOCK | O_CLOEXEC) != 0)
+      {
+        const auto error {errno};
+        close_();
+        throw std::system_error {error, std::generic_category(), "unix_socket_server"};
+      }
+
+      if (not bind() and not (errno == EADDRINUSE and stale_(address) and ::unlink(path.c_str()) == 0 and bind()))
+      {
+        const auto error {errno};
+        close_();
+        throw std::system_error {error, std::generic_category(), "unix_socket_server: bind " + path};
+      }
+
+      if (::listen(listener_, SOMAXCONN) != 0)
+      {
+        const auto error {errno};
+        ::unlink(path_.c_str());
+        close_();
+        throw std::system_error {error, std::generic_category(), "unix_socket_server: listen " + path};
+      }
+    }
+
+    unix_socket_server(const unix_socket_server&) = delete;
+    auto operator=(const unix_socket_server&) -> unix_socket_server& = delete;
+
+    ~unix_socket_server()
+    {
+      for (const auto& each : connections_)
+      {
+        ::close(each.fd);
+      }
+
+      ::unlink(path_.c_str());
+      close_();
+    }
+
+    // run() を終わらせる。シグナルハンドラからも呼べる
+    void stop() const noexcept
+    {
+      [[maybe_unused]] const auto n {::write(wakeup_[1], "", 1)};
+    }
+
+    // stop() されるまで要求を処理する
+    void run(const handler_type& handler)
+    {
+      std::vector<::pollfd> fds {};
+
+      for (bool ready {false}; true; )
+      {
+        fds.clear();
+        fds.push_back({wakeup_[0], POLLIN, 0});
+        fds.push_back({listener_, POLLIN, 0});
+
+        for (const auto& each : connections_)
+        {
+          fds.push_back({each.fd, static_cast<short>((not each.closing and std::size(each.output) < max_pending_output ? POLLIN : 0) |
+                                                     (std::empty(each.output) ? 0 : POLLOUT)), 0});
+        }
+
+        if (::poll(std::data(fds), std::size(fds), ready ? 0 : -1) < 0) // 後回しにした要求があれば待たない
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          else throw std::system_error {errno, std::generic_category(), "unix_socket_server: poll"};
+        }
+
+        if (fds[0].revents)
+        {
+          return;
+        }
+
+        ready = false;
+
+        // 接続の添字は fds の添字と二つずれる。閉じた接続は後でまとめて取り除く
+        for (std::size_t index {0}; index < std::size(connections_); ++index)
+        {
+          auto& each {connections_[index]};
+
+          if (fds[index + 2].revents & (POLLIN | POLLHUP | POLLERR))
+          {
+            receive_(each);
+          }
+
+          respond_(each, handler);
+          send_(each);
+
+          ready = ready or ready_(each);
+        }
+
+        connections_.erase(std::remove_if(std::begin(connections_), std::end(connections_), [](const auto& each)
+        {
+          if (each.fd < 0)
+          {
+            return true;
+          }
+          else if (each.closing and std::empty(each.output) and std::empty(each.input))
+          {
+            ::close(each.fd);
+            return true;
+          }
+          else return false;
+        }), std::end(connections_));
+
+        if (fds[1].revents & POLLIN)
+        {
+          accept_();
+        }
+      }
+    }
+
+  protected:
+    void close_() noexcept
+    {
+      for (auto* each : {&listener_, &wakeup_[0], &wakeup_[1]})
+      {
+        if (0 <= *each)
+        {
+          ::close(std::exchange(*each, -1));
+        }
+      }
+    }
+
+    static bool stale_(const ::sockaddr_un& address) noexcept
+    {
+      const auto fd {::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+
+      if (fd < 0)
+      {
+        return false;
+      }
+
+      const auto refused {::connect(fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0 and errno == ECONNREFUSED};
+      ::close(fd);
+
+      errno = EADDRINUSE; // 消せなかった場合の報告用
+      return refused;
+    }
+
+    void accept_()
+    {
+      while (true)
+      {
+        if (const auto fd {::accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)}; 0 <= fd)
+        {
+          connections_.push_back({fd});
+        }
+        else if (errno != EINTR and errno != ECONNABORTED) // EAGAIN などはまた次に
+        {
+          return;
+        }
+      }
+    }
+
+    static void drop_(connection& c) noexcept
+    {
+      ::close(std::exchange(c.fd, -1));
+    }
+
+    // 一度に一回分だけ読む。poll(2) はレベルトリガなので残りは次に読め、速く送り続ける接続に入力を溜め込まれない
+    static void receive_(connection& c)
+    {
+      char buffer[64 * 1024];
+
+      while (0 <= c.fd and not c.closing and std::size(c.output) < max_pending_output)
+      {
+        if (const auto n {::recv(c.fd, buffer, sizeof(buffer), 0)}; 0 < n)
+        {
+          c.input.append(buffer, n);
+          return;
+        }
+        else if (n == 0)
+        {
+          c.closing = true;
+        }
+        else if (errno == EAGAIN or errno == EWOULDBLOCK)
+        {
+          return;
+        }
+        else if (errno != EINTR)
+        {
+          drop_(c);
+        }
+      }
+    }
+
+    // 揃った要求を順に処理する。溜まった応答が多すぎれば、書き出すまで残りは後回しにする
+    static void respond_(connection& c, const handler_type& handler)
+    {
+      std::size_t offset {0};
+
+      while (0 <= c.fd and std::size(c.output) < max_pending_output and 4 <= std::size(c.input) - offset)
+      {
+        const auto size {static_cast<std::uint32_t>(decode_(std::string_view {c.input}.substr(offset, 4)))};
+
+        if (max_request_size < size)
+        {
+          drop_(c);
+          return;
+        }
+        else if (std::size(c.input) - offset - 4 < size)
+        {
+          break;
+        }
+
+        response_type response {};
+
+        const auto begin {std::chrono::steady_clock::now()};
+
+        try
+        {
+          response = handler(std::string_view {c.input}.substr(offset + 4, size));
+        }
+        catch (const std::exception& ex)
+        {
+          response = {ex.what(), status::failure};
+        }
+
+        const auto elapsed {std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()};
+
+        encode_(c.output, std::size(response.body), 4);
+        encode_(c.output, static_cast<std::uint8_t>(response.state), 1);
+        encode_(c.output, elapsed, 8);
+        c.output += response.body;
+
+        offset += 4 + size;
+      }
+
+      c.input.erase(0, offset);
+
+      if (c.closing and not std::empty(c.input) and std::size(c.output) < max_pending_output) // 途中で切れた要求は捨てる
+      {
+        c.input.clear();
+      }
+    }
+
+    // 処理できる要求が残っている
+    static bool ready_(const connection& c) noexcept
+    {
+      return 0 <= c.fd and std::size(c.output) < max_pending_output and 4 <= std::size(c.input) and decode_(std::string_view {c.input}.substr(0, 4)) <= std::size(c.input) - 4;
+    }
+
+    static void send_(connection& c)
+    {
+      std::size_t offset {0};
+
+      while (0 <= c.fd and offset < std::size(c.output))
+      {
+        if (const auto n {::send(c.fd, std::data(c.output) + offset, std::size(c.output) - offset, MSG_NOSIGNAL)}; 0 <= n)
+        {
+          offset += n;
+        }
+        else if (errno == EAGAIN or errno == EWOULDBLOCK)
+        {
+          break;
+        }
+        else if (errno != EINTR)
+        {
+          drop_(c);
+        }
+      }
+
+      c.output.erase(0, offset);
+    }
+
+    static auto decode_(std::string_view bytes) noexcept
+      -> std::uint64_t
+    {
+      std::uint64_t result {0};
+
+      for (const auto each : bytes)
+      {
+        result = result << 8 | static_cast<unsigned char>(each);
+      }
+
+      return result;
+    }
+
+    static void encode_(std::string& out, std::uint64_t value, std::size_t size)
+    {
+      for (auto shift {size * 8}; 0 < shift; shift -= 8)
+      {
+        out.push_back(static_cast<char>(value >> (shift - 8)));
+      }
+    }
+  };
+} // namespace utility
+
+
+#endif // INCLUDED_CORELISP_UTILITY_UNIX_SOCKET_SERVER_HPP
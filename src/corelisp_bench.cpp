@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory_resource>
+#include <numeric>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/cstdlib.hpp>
+
+#include <unistd.h>
+
+#include <corelisp/builtin/core.hpp>
+#include <corelisp/lisp/evaluator.hpp>
+#include <corelisp/lisp/reader.hpp>
+#include <corelisp/lisp/tokenizer.hpp>
+#include <corelisp/lisp/vectored_cons_cells.hpp>
+#include <corelisp/utility/allocation_counter.hpp> // 確保の回数と量を数える
+
+
+struct benchmark
+{
+  std::string name, engine;
+
+  std::size_t operations; // 一回の計測で行う操作の数
+  std::size_t bytes;      // 一回の計測で処理する入力の量（構文解析のみ）
+
+  std::vector<double> nanoseconds; // 計測毎の一操作あたりの時間
+  double allocations, allocated_bytes; // 一操作あたり
+
+  // 計測を終えた時点のプロセス全体の常駐量と、ウォームアップの前からの増分（KiB）。
+  // 最大常駐量は単調に増えるだけで、先に測った計測の分と区別できないので使わない
+  long resident, resident_growth;
+};
+
+auto resident()
+  -> long
+{
+  long size {0}, pages {0}; // 二つ目の欄が常駐しているページ数
+
+  std::ifstream {"/proc/self/statm"} >> size >> pages;
+
+  return pages * (::sysconf(_SC_PAGESIZE) / 1024);
+}
+
+template <typename F>
+auto measure(std::string name, std::string engine, std::size_t operations, std::size_t bytes, std::size_t warmup, std::size_t repetitions, F&& f)
+  -> benchmark
+{
+  using namespace std::chrono;
+
+  benchmark result {std::move(name), std::move(engine), operations, bytes, {}, 0, 0, 0, 0};
+
+  const auto first_resident {resident()};
+
+  for (std::size_t count {0}; count < warmup; ++count)
+  {
+    f();
+  }
+
+  const auto first_allocations {utility::allocations()};
+  const auto first_allocated_bytes {utility::allocated_bytes()};
+
+  for (std::size_t count {0}; count < repetitions; ++count)
+  {
+    const auto begin {steady_clock::now()};
+    f();
+    const auto end {steady_clock::now()};
+
+    result.nanoseconds.push_back(static_cast<double>(duration_cast<nanoseconds>(end - begin).count()) / operations);
+  }
+
+  const auto total {static_cast<double>(std::max<std::size_t>(repetitions, 1) * operations)};
+
+  result.allocations = (utility::allocations() - first_allocations) / total;
+  result.allocated_bytes = (utility::allocated_bytes() - first_allocated_bytes) / total;
+  result.resident = resident();
+  result.resident_growth = result.resident - first_resident;
+
+  return result;
+}
+
+// 定義と計測する式、その期待する結果
+struct workload
+{
+  std::string name;
+  std::vector<std::string> definitions;
+  std::string expression, expected;
+};
+
+const std::vector<workload> workloads
+{
+  {"fib", {"(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"}, "(fib 25)", "75025"},
+  {"tarai", {"(define tarai (lambda (x y z) (if (<= x y) y (tarai (tarai (- x 1) y z) (tarai (- y 1) z x) (tarai (- z 1) x y)))))"}, "(tarai 10 5 0)", "10"},
+  {"factorial", {"(define factorial (lambda (n) (cond ((< n 0) false) ((<= n 1) 1) (true (* n (factorial (- n 1)))))))"}, "(factorial 20)", "2432902008176640000"},
+  {"cons", {"(define build (lambda (n e) (if (= n 0) e (build (- n 1) (cons n e)))))"}, "(car (build 10000 (quote ())))", "1"},
+  {"cdr", {"(define build (lambda (n e) (if (= n 0) e (build (- n 1) (cons n e)))))",
+           "(define walk (lambda (e n) (if (eq e (quote ())) n (walk (cdr e) (+ n 1)))))",
+           "(define long (build 10000 (quote ())))"}, "(walk long 0)", "10000"}
+};
+
+// 構文解析用の入力。変数名と数値を散らした、大きめの定義が並ぶファイル
+auto generate(std::size_t forms)
+{
+  std::string text {};
+
+  for (std::size_t index {0}; index < forms; ++index)
+  {
+    const auto n {std::to_string(index)};
+
+    text += "(define f" + n + "\n"
+            "  (lambda (x y z)\n"
+            "    (cond ((< x " + n + ") (quote (alpha beta (gamma " + n + " 2.5) delta)))\n"
+            "          ((= y " + n + ".25) (cons x (cons y (quote ()))))\n"
+            "          (true (+ x y z " + n + " (* x " + n + "))))))\n";
+  }
+
+  return text;
+}
+
+void print(std::ostream& os, const std::vector<benchmark>& results, std::size_t warmup, std::size_t repetitions)
+{
+  os << "{\n"
+     << "  \"warmup\": " << warmup << ",\n"
+     << "  \"repetitions\": " << repetitions << ",\n"
+     << "  \"benchmarks\": [";
+
+  for (auto iter {std::begin(results)}; iter != std::end(results); ++iter)
+  {
+    auto samples {(*iter).nanoseconds};
+    std::sort(std::begin(samples), std::end(samples));
+
+    const auto mean {std::accumulate(std::begin(samples), std::end(samples), 0.0) / std::max<std::size_t>(std::size(samples), 1)};
+    const auto median {std::empty(samples) ? 0.0 : std::size(samples) % 2 ? samples[std::size(samples) / 2]
+                                                                           : (samples[std::size(samples) / 2 - 1] + samples[std::size(samples) / 2]) / 2};
+
+    os << (iter != std::begin(results) ? "," : "") << "\n"
+       << "    {\n"
+       << "      \"name\": \"" << (*iter).name << "\",\n"
+       << "      \"engine\": \"" << (*iter).engine << "\",\n"
+       << "      \"operations\": " << (*iter).operations << ",\n"
+       << "      \"ns_per_op\": {"
+       <<         "\"min\": " << (std::empty(samples) ? 0.0 : samples.front()) << ", "
+       <<         "\"median\": " << median << ", "
+       <<         "\"mean\": " << mean << ", "
+       <<         "\"max\": " << (std::empty(samples) ? 0.0 : samples.back()) << "},\n";
+
+    if ((*iter).bytes)
+    {
+      os << "      \"bytes_per_op\": " << static_cast<double>((*iter).bytes) / (*iter).operations << ",\n"
+         << "      \"mb_per_second\": " << (median ? (*iter).bytes / ((*iter).operations * median) * 1e3 : 0.0) << ",\n";
+    }
+
+    os << "      \"allocations_per_op\": " << (*iter).allocations << ",\n"
+       << "      \"allocated_bytes_per_op\": " << (*iter).allocated_bytes << ",\n"
+       << "      \"resident_kib\": " << (*iter).resident << ",\n"
+       << "      \"resident_growth_kib\": " << (*iter).resident_growth << "\n"
+       << "    }";
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+
+int main(int argc, char** argv)
+{
+  const std::vector<std::string> args {argv + 1, argv + argc};
+
+  std::vector<std::string> engines {"tree", "vm"};
+
+  std::size_t warmup {2}, repetitions {10}, forms {20000};
+
+  std::regex filter {".*"};
+
+  for (auto iter {std::begin(args)}; iter != std::end(args); ++iter) [&]()
+  {
+    std::match_results<std::string::const_iterator> results {};
+
+    if (std::regex_match(*iter, results, std::regex {"--engine=(tree|vm)"}))
+    {
+      engines = {results[1]};
+      return;
+    }
+
+    if (std::regex_match(*iter, results, std::regex {"--warmup=([0-9]+)"}))
+    {
+      warmup = std::stoul(results[1]);
+      return;
+    }
+
+    if (std::regex_match(*iter, results, std::regex {"--repetitions=([1-9][0-9]*)"}))
+    {
+      repetitions = std::stoul(results[1]);
+      return;
+    }
+
+    if (std::regex_match(*iter, results, std::regex {"--forms=([1-9][0-9]*)"}))
+    {
+      forms = std::stoul(results[1]);
+      return;
+    }
+
+    if (std::regex_match(*iter, results, std::regex {"--filter=(.+)"}))
+    {
+      filter = std::regex {results[1].str()};
+      return;
+    }
+
+    for (const auto& each : std::vector<std::string> {"-h", "--help"})
+    {
+      if (std::regex_match(*iter, std::regex {each}))
+      {
+        std::cout << "usage: " << argv[0] << " [--engine=(tree|vm)] [--warmup=N] [--repetitions=N] [--forms=N] [--filter=REGEX]\n"
+                     "\n"
+                     "Runs the fixed workload suite and prints the results as JSON to standard output." << std::endl;
+        std::exit(boost::exit_success);
+      }
+    }
+
+    std::cerr << "[error] unexpected option specified: \e[31m\"" << *iter << "\"\e[0m" << std::endl;
+    std::exit(boost::exit_failure);
+  }();
+
+  std::vector<benchmark> results {};
+
+  for (const auto& engine : engines)
+  {
+    lisp::evaluator evaluate {};
+    builtin::define(evaluate);
+
+    evaluate.engine = engine == "vm" ? lisp::evaluator::engine_type::virtual_machine
+                                     : lisp::evaluator::engine_type::analyzer;
+
+    for (const auto& each : workloads)
+    {
+      if (not std::regex_match(each.name, filter))
+      {
+        continue;
+      }
+
+      for (const auto& definition : each.definitions)
+      {
+        evaluate(definition);
+      }
+
+      std::stringstream ss {};
+      ss << evaluate(each.expression);
+
+      if (ss.str() != each.expected) // 誤った結果（エラーを含む）の速さを測っても意味がない
+      {
+        std::cerr << "[error] " << each.name << " (" << engine << "): expected " << each.expected << ", got " << ss.str() << std::endl;
+        return boost::exit_failure;
+      }
+
+      results.push_back(measure(each.name, engine, 1, 0, warmup, repetitions, [&]()
+      {
+        evaluate(each.expression);
+      }));
+    }
+  }
+
+  if (std::regex_match(std::string {"parse"}, filter)) // 一時ファイルに書き出した入力をトップレベル単位で読み、構文木を組み立てる
+  {
+    const auto text {generate(forms)};
+
+    char path[] {"/tmp/corelisp_bench.XXXXXX"};
+
+    if (const auto fd {::mkstemp(path)}; fd < 0 or ::close(fd) != 0)
+    {
+      std::cerr << "[error] failed to create a temporary file" << std::endl;
+      return boost::exit_failure;
+    }
+    else if (std::ofstream ofs {path}; not (ofs << text))
+    {
+      std::cerr << "[error] failed to write: \e[31m\"" << path << "\"\e[0m" << std::endl;
+      std::remove(path);
+      return boost::exit_failure;
+    }
+
+    std::size_t count {0};
+
+    results.push_back(measure("parse", "none", forms, std::size(text), warmup, repetitions, [&]()
+    {
+      std::ifstream ifs {path};
+
+      count = 0;
+
+      for (lisp::reader read {ifs}; const auto form {read()}; ++count)
+      {
+        std::array<std::byte, 4096> buffer;
+        std::pmr::monotonic_buffer_resource resource {std::data(buffer), std::size(buffer)};
+
+        const lisp::vectored_cons_cells e {lisp::token_views {*form, &resource}, &resource};
+
+        if (std::size(e) != 3)
+        {
+          throw std::runtime_error {"parse: unexpected form"};
+        }
+      }
+    }));
+
+    std::remove(path);
+
+    if (count != forms)
+    {
+      std::cerr << "[error] parse: expected " << forms << " forms, got " << count << std::endl;
+      return boost::exit_failure;
+    }
+  }
+
+  print(std::cout, results, warmup, repetitions);
+
+  return boost::exit_success;
+}
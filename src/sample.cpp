@@ -1,126 +1,104 @@
 #include <chrono>
+#include <csignal>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <regex>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
 #include <boost/cstdlib.hpp>
-#include <boost/multiprecision/gmp.hpp>
 
 #include <corelisp/lisp/evaluator.hpp>
+#include <corelisp/lisp/reader.hpp>
 #include <corelisp/lisp/tokenizer.hpp>
 #include <corelisp/lisp/vectored_cons_cells.hpp>
-#include <corelisp/builtin/arithmetic.hpp>
+#include <corelisp/builtin/core.hpp>
+#include <corelisp/utility/unix_socket_server.hpp>
 
+#ifdef CORELISP_COUNT_ALLOCATIONS // 大域の operator new を置き換えるので、プロファイル用のビルドでのみ使う
+#include <corelisp/utility/allocation_counter.hpp>
+#endif
 
-auto define_builtins = [&]()
+
+int main(int argc, char** argv)
 {
-  using namespace lisp;
+  std::ios_base::sync_with_stdio(false); // 標準入力をバッファしてチャンク単位で読めるようにする
 
-  evaluate["quote"] = [&](auto& e, auto&) noexcept
-    -> decltype(auto)
-  {
-    return std::size(e) != 2 ? false_value : e[1];
-  };
+  const std::vector<std::string> args {argv + 1, argv + argc};
 
-  evaluate["atom"] = [&](auto& e, auto& env)
-    -> decltype(auto)
+  // 読めない部分は報告して読み飛ばし、次の形式から続ける
+  const auto next = [](lisp::reader& read)
+    -> std::optional<std::string_view>
   {
-    return evaluate(e.at(1), env).is_atom() ? true_value : false_value;
+    while (true) try
+    {
+      return read();
+    }
+    catch (const std::exception& ex)
+    {
+      std::cerr << "(error: " << ex.what() << ")" << std::endl;
+    }
   };
 
-  evaluate["eq"] = [](auto& e, auto&) // XXX EQって可変長じゃなくても良かったっけ
-    -> decltype(auto)
-  {
-    return  e.at(1) != e.at(2) ? false_value : true_value;
-  };
+  lisp::evaluator evaluate {};
 
-  evaluate["car"] = [&](auto& expr, auto& scope) // TODO クソ
-    -> decltype(auto)
-  {
-    return evaluate(expr.at(1), scope).at(0);
-  };
+  std::vector<std::string> scripts {};
 
-  evaluate["cdr"] = [&](auto& expr, auto& scope) // TODO クソ
-    -> decltype(auto)
-  {
-    auto buffer {evaluate(expr.at(1), scope)};
-    return expr = (std::size(buffer) != 0 ? buffer.erase(std::begin(buffer)), std::move(buffer) : false_value);
-  };
+  std::string image {}, save_image {}, profile {}, listen {};
 
-  evaluate["cons"] = [&](auto& expr, auto& scope) // TODO クソ
-    -> decltype(auto)
+  for (auto iter {std::begin(args)}; iter != std::end(args); ++iter) [&]()
   {
-    vectored_cons_cells buffer {};
-
-    buffer.push_back(evaluate(expr.at(1), scope));
+    std::match_results<std::string::const_iterator> results {};
 
-    for (const auto& each : evaluate(expr.at(2), scope))
+    if (std::regex_match(*iter, results, std::regex {"--engine=(tree|vm)"}))
     {
-      buffer.push_back(each);
+      evaluate.engine = results[1] == "vm" ? lisp::evaluator::engine_type::virtual_machine
+                                                 : lisp::evaluator::engine_type::analyzer;
+      return;
     }
 
-    return expr = std::move(buffer);
-  };
-
-  evaluate["cond"] = [&](auto& e, auto& env)
-    -> vectored_cons_cells&
-  {
-    for (auto iter {std::begin(e) + 1}; iter != std::end(e); ++iter)
+    if (std::regex_match(*iter, results, std::regex {"--image=(.+)"}))
     {
-      if (evaluate(iter->at(0), env) != false_value)
-      {
-        return evaluate(iter->at(1), env);
-      }
+      image = results[1];
+      return;
     }
 
-    return false_value; // TODO
-  };
-
-  evaluate["lambda"] = [](auto& expr, auto& scope)
-    -> decltype(auto)
-  {
-    expr.closure = scope;
-    return expr;
-  };
-
-  evaluate["define"] = [&](auto& e, auto& env) noexcept
-    -> decltype(auto)
-  {
-    return std::size(e) != 3 ? false_value : (env.emplace(e[1].value, evaluate(e[2], env).share()), e[2]);
-  };
-
-  evaluate["if"] = [&](auto& e, auto& env) noexcept
-    -> decltype(auto)
-  {
-    return std::size(e) != 4 ? false_value : evaluate(evaluate(e[1], env) != false_value ? e[2] : e[3], env);
-  };
+    if (std::regex_match(*iter, results, std::regex {"--save-image=(.+)"}))
+    {
+      save_image = results[1];
+      return;
+    }
 
-  using value_type = boost::multiprecision::mpf_float;
-  evaluate["+"]  = builtin::arithmetic<value_type, std::plus> {};
-  evaluate["-"]  = builtin::arithmetic<value_type, std::minus> {};
-  evaluate["*"]  = builtin::arithmetic<value_type, std::multiplies> {};
-  evaluate["/"]  = builtin::arithmetic<value_type, std::divides> {};
-  evaluate["="]  = builtin::arithmetic<value_type, std::equal_to> {};
-  evaluate["<"]  = builtin::arithmetic<value_type, std::less> {};
-  evaluate["<="] = builtin::arithmetic<value_type, std::less_equal> {};
-  evaluate[">"]  = builtin::arithmetic<value_type, std::greater> {};
-  evaluate[">="] = builtin::arithmetic<value_type, std::greater_equal> {};
-};
+    if (std::regex_match(*iter, results, std::regex {"--listen=(.+)"}))
+    {
+      listen = results[1];
+      return;
+    }
 
+    if (std::regex_match(*iter, results, std::regex {"--optimize(=(verbose))?"})) // verbose なら書き換えを標準エラー出力に書く
+    {
+      evaluate.optimize = true;
+      evaluate.optimization().log = results[2].matched ? &std::cerr : nullptr;
+      return;
+    }
 
-int main(int argc, char** argv)
-{
-  const std::vector<std::string> args {argv + 1, argv + argc};
+    if (std::regex_match(*iter, results, std::regex {"--profile(=(report|collapsed))?"})) // スクリプトの評価を計測して標準エラー出力に書く
+    {
+      profile = results[2].matched ? results[2].str() : "report";
+      return;
+    }
 
-  for (auto iter {std::begin(args)}; iter != std::end(args); ++iter) [&]()
-  {
-    std::match_results<std::string::const_iterator> results {};
+    if (not std::empty(*iter) and (*iter)[0] != '-')
+    {
+      scripts.push_back(*iter);
+      return;
+    }
 
     for (const auto& each : std::vector<std::string> {"-h", "--help"})
     {
@@ -135,52 +113,142 @@ int main(int argc, char** argv)
     std::exit(boost::exit_failure);
   }();
 
-  define_builtins();
+  builtin::define(evaluate);
 
-  std::vector<std::string> tests
+#ifdef CORELISP_COUNT_ALLOCATIONS
+  evaluate.profile().allocations = utility::allocations;
+#endif
+
+  if (not std::empty(image)) try // 前置きの評価を省略してイメージから開始する
   {
-    "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
-    "(define tarai (lambda (x y z) (if (<= x y) y (tarai (tarai (- x 1) y z) (tarai (- y 1) z x) (tarai (- z 1) x y)))))",
-    // "(define map (lambda (f e) (if (eq? e false) false (cons (f (car e)) (map f (cdr e))))))",
-    "(define x (quote (1 2 3 4 5)))",
-    "(define factorial (lambda (n) (cond ((< n 0) false) ((<= n 1) 1) (true (* n (factorial (- n 1)))))))"
-  };
+    evaluate.load(image);
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << "[error] " << ex.what() << std::endl;
+    return boost::exit_failure;
+  }
+  else
+  {
+    std::vector<std::string> tests
+    {
+      "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+      "(define tarai (lambda (x y z) (if (<= x y) y (tarai (tarai (- x 1) y z) (tarai (- y 1) z x) (tarai (- z 1) x y)))))",
+      // "(define map (lambda (f e) (if (eq? e false) false (cons (f (car e)) (map f (cdr e))))))",
+      "(define x (quote (1 2 3 4 5)))",
+      "(define factorial (lambda (n) (cond ((< n 0) false) ((<= n 1) 1) (true (* n (factorial (- n 1)))))))"
+    };
+
+    for (const auto& each : tests)
+    {
+      evaluate(each);
+    }
+
+    if (not std::empty(profile))
+    {
+      evaluate.start_profile();
+    }
+
+    for (const auto& each : scripts) // 複数行にまたがる形式もトップレベル単位で評価する
+    {
+      std::ifstream ifs {each};
+
+      if (not ifs)
+      {
+        std::cerr << "[error] failed to open: \e[31m\"" << each << "\"\e[0m" << std::endl;
+        return boost::exit_failure;
+      }
+
+      for (lisp::reader read {ifs}; const auto form {next(read)};)
+      {
+        evaluate(*form);
+      }
+    }
+
+    if (not std::empty(profile))
+    {
+      evaluate.stop_profile();
 
-  for (const auto& each : tests)
+      if (profile == "collapsed")
+      {
+        evaluate.profile().collapse(std::cerr);
+      }
+      else evaluate.profile().report(std::cerr);
+    }
+  }
+
+  if (not std::empty(save_image)) try
   {
-    lisp::evaluate(each);
+    evaluate.save(save_image);
   }
+  catch (const std::exception& ex)
+  {
+    std::cerr << "[error] " << ex.what() << std::endl;
+    return boost::exit_failure;
+  }
+
+  // 対話ループの代わりに、温めた環境のまま Unix ドメインソケットに届いた要求を評価し続ける。
+  // 要求の本体のトップレベル形式を順に評価し、それぞれの結果（とエラー）を一行ずつ返す。SIGINT か SIGTERM で終わる
+  if (not std::empty(listen)) try
+  {
+    static utility::unix_socket_server* server {nullptr};
+
+    utility::unix_socket_server listener {listen};
+    server = &listener;
+
+    for (const auto signal : {SIGINT, SIGTERM})
+    {
+      std::signal(signal, [](int) { server->stop(); });
+    }
+
+    std::cerr << "; listening on " << listen << std::endl;
+
+    evaluate.rethrow = true; // エラーは端末用の装飾なしで、その形式の結果として返す
+
+    listener.run([&](std::string_view request)
+    {
+      using server_type = utility::unix_socket_server;
+
+      auto state {server_type::status::success};
+
+      std::stringstream ss {};
+
+      std::istringstream is {std::string {request}};
+
+      for (lisp::reader read {is}; true; ) try // 読めない部分も報告して読み飛ばし、次の形式から続ける
+      {
+        if (const auto form {read()}; form)
+        {
+          ss << evaluate(*form) << "\n";
+        }
+        else break;
+      }
+      catch (const std::exception& ex)
+      {
+        ss << "(error: " << ex.what() << ")\n";
+        state = server_type::status::failure; // 一つでも失敗した形式があれば要求全体を失敗とする
+      }
+
+      return server_type::response_type {ss.str(), state};
+    });
+
+    return boost::exit_success;
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << "[error] " << ex.what() << std::endl;
+    return boost::exit_failure;
+  }
+
+  lisp::reader read {std::cin};
 
-  // std::fstream fstream {"../tests.scm", std::ios_base::in};
-  //
-  // std::string library {"(quote ("};
-  //
-  // for (std::string buffer {}; std::getline(fstream, buffer);)
-  // {
-  //   library += buffer;
-  //
-  //   for (const auto& each : buffer)
-  //   {
-  //     std::this_thread::sleep_for(std::chrono::milliseconds {10});
-  //     std::cout << each << std::flush;
-  //   }
-  //
-  //   std::cout << std::endl;
-  // }
-  //
-  // library += "))";
-  //
-  // std::cout << "[debug] library evaluation "
-  //           << (lisp::evaluate(library) != lisp::false_value ? "succeeded" : "failed")
-  //           << "\n\n";
-
-  for (std::string buffer {}; std::cout << ">> ", std::getline(std::cin, buffer);)
+  for (std::optional<std::string_view> form {}; std::cout << ">> " << std::flush, form = next(read);)
   {
     using namespace std::chrono;
 
     const auto begin {high_resolution_clock::now()};
 
-    std::cout << lisp::evaluate(buffer)
+    std::cout << evaluate(*form)
               << " in "
               << duration_cast<milliseconds>(high_resolution_clock::now() - begin).count()
               << "msec\n\n";
@@ -0,0 +1,77 @@
+// memoize の表を書き換える評価と (gc) を同時に走らせる。評価器毎の collector と、
+// 一つの評価器の中で pcall が並べたもの。回収中に表から外された値を辿っても落ちないこと
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <corelisp/builtin/core.hpp>
+#include <corelisp/lisp/evaluator.hpp>
+
+const std::string definitions[]
+{
+  "(define f (memoize (lambda (x) (lambda () x)) 1))",
+  "(define churn (lambda (n) (if (= n 0) 0 (if (f n) (churn (- n 1)) 0))))",
+  "(define collect (lambda (n) (if (= n 0) 0 (if (gc) (collect (- n 1)) (collect (- n 1))))))"
+};
+
+auto evaluate(lisp::evaluator& evaluate, const std::string& expression)
+{
+  std::stringstream ss {};
+  ss << evaluate(expression);
+  return ss.str();
+}
+
+int main()
+{
+  for (const auto* engine : {"tree", "vm"})
+  {
+    const auto prepare = [&](lisp::evaluator& evaluate)
+    {
+      builtin::define(evaluate);
+
+      evaluate.engine = std::string {engine} == "vm" ? lisp::evaluator::engine_type::virtual_machine
+                                                     : lisp::evaluator::engine_type::analyzer;
+
+      for (const auto& each : definitions)
+      {
+        ::evaluate(evaluate, each);
+      }
+    };
+
+    {
+      lisp::evaluator a {0}, b {0};
+
+      prepare(a);
+      prepare(b);
+
+      std::string churned {}, collected {};
+
+      std::thread thread {[&]() { churned = evaluate(a, "(churn 200000)"); }};
+      collected = evaluate(b, "(collect 20000)");
+      thread.join();
+
+      if (churned != "0" or collected != "0")
+      {
+        std::cerr << engine << ": two evaluators: " << churned << " " << collected << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    {
+      lisp::evaluator a {2};
+
+      prepare(a);
+
+      if (const auto result {evaluate(a, "(pcall + (churn 200000) (collect 20000))")}; result != "0")
+      {
+        std::cerr << engine << ": pcall: " << result << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
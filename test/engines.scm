@@ -0,0 +1,31 @@
+(+ 1 2 3)
+(- 10 4 3)
+(* 2 3 4)
+(/ 12 4)
+(< 1 2)
+(>= 1 2)
+(fib 15)
+(tarai 6 3 0)
+(factorial 10)
+(quote (a (b c) d))
+(car (quote (1 2 3)))
+(cdr (cdr (quote (1 2 3))))
+(cons 0 (quote (1 2)))
+(atom (quote a))
+(atom (quote (a)))
+(eq (quote a) (quote a))
+(eq (cdr x) (cdr x))
+(if (< 1 2) (quote yes) (quote no))
+(cond ((< 2 1) 1) ((< 1 2) 2) (true 3))
+(define adder (lambda (n) (lambda (x) (+ x n))))
+((adder 10) 5)
+(define compose (lambda (f g) (lambda (x) (f (g x)))))
+((compose (adder 1) (adder 2)) 3)
+(define count-down (lambda (n) (if (= n 0) (quote done) (count-down (- n 1)))))
+(count-down 100000)
+(define length (lambda (e n) (if (atom e) n (if (eq e (quote ())) n (length (cdr e) (+ n 1))))))
+(length (quote (1 2 3 4 5)) 0)
+(pcall + (fib 10) (fib 11))
+(pmap (adder 1) (quote (1 2 3)))
+unbound-symbol
+((lambda (a b) a) 1)
@@ -0,0 +1,141 @@
+// 大域環境の公開。読み手はロックを取らずに、書き手が公開した順に名前と値を見ること。
+// 区間の中で読んだ値は解放されないこと。pmap の中の define が全てのワーカーから見えること
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <corelisp/builtin/core.hpp>
+#include <corelisp/lisp/evaluator.hpp>
+#include <corelisp/lisp/global_environment.hpp>
+#include <corelisp/lisp/inline_cache.hpp>
+
+#define CHECK(...)                                                             \
+  if (not (__VA_ARGS__))                                                       \
+  {                                                                            \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #__VA_ARGS__ << std::endl; \
+    return EXIT_FAILURE;                                                       \
+  }
+
+int main()
+{
+  using lisp::fixnum, lisp::number;
+
+  constexpr fixnum size {2000}, rounds {20};
+
+  {
+    lisp::global_environment env {};
+
+    std::vector<lisp::symbol> names {};
+
+    for (fixnum index {0}; index < size; ++index)
+    {
+      names.emplace_back("n" + std::to_string(index));
+    }
+
+    std::atomic<bool> done {false};
+    std::atomic<std::size_t> errors {0};
+
+    std::vector<std::thread> readers {};
+
+    for (auto count {0}; count < 4; ++count)
+    {
+      readers.emplace_back([&]()
+      {
+        lisp::inline_cache<lisp::global_environment> cache {};
+
+        std::vector<fixnum> seen(size, -1); // 名前毎に見た値。書き手は値を増やす一方なので減ってはならない
+
+        while (not done.load())
+        {
+          lisp::global_environment::reader reader {};
+
+          for (fixnum index {size - 1}; 0 <= index; --index) // 後に公開した名前が見えれば、先に公開した名前も見える
+          {
+            if (const auto* entry {env.find(names[index])}; entry)
+            {
+              const auto value {std::get<fixnum>((*entry).value().as_number())};
+
+              if (value % size != index or value < seen[index])
+              {
+                ++errors;
+              }
+
+              seen[index] = value;
+            }
+            else if (index + 1 < size and seen[index + 1] != -1)
+            {
+              ++errors;
+            }
+          }
+
+          if (const auto* entry {cache.find(env, names[0])}; entry and not (*entry).value().is_number())
+          {
+            ++errors;
+          }
+        }
+      });
+    }
+
+    for (fixnum round {0}; round < rounds; ++round)
+    {
+      for (fixnum index {0}; index < size; ++index)
+      {
+        env.insert_or_assign(names[index], lisp::vectored_cons_cells {number {round * size + index}});
+      }
+    }
+
+    done = true;
+
+    for (auto& each : readers)
+    {
+      each.join();
+    }
+
+    CHECK(errors == 0);
+
+    env.reclaim();
+
+    lisp::global_environment::reader reader {};
+
+    std::size_t count {0};
+
+    env.for_each([&](const auto& name, const auto& value)
+    {
+      count += (*env.find(name)).value() == value;
+    });
+
+    CHECK(count == size);
+    CHECK((*env.find(names[size - 1])).value().as_number() == number {rounds * size - 1});
+  }
+
+  for (const auto engine : {lisp::evaluator::engine_type::analyzer, lisp::evaluator::engine_type::virtual_machine})
+  {
+    lisp::evaluator evaluate {4};
+    builtin::define(evaluate);
+    evaluate.engine = engine;
+
+    const auto print = [&](const std::string& expression)
+    {
+      std::stringstream ss {};
+      ss << evaluate(expression);
+      return ss.str();
+    };
+
+    print("(define g (lambda (x) (* x 2)))");
+    print("(pmap (lambda (x) (define shared (g x))) (quote (1 2 3 4 5 6 7 8 9 10 11 12)))");
+
+    const auto shared {print("shared")};
+    CHECK(print("(pmap (lambda (x) shared) (quote (1 2 3 4)))") == "(" + shared + " " + shared + " " + shared + " " + shared + ")");
+
+    print("(pmap (lambda (x) (define g (lambda (y) (+ y x)))) (quote (1 2 3 4)))"); // どれか一つの版が残る
+    const auto redefined {print("(g 0)")};
+    CHECK(redefined == "1" or redefined == "2" or redefined == "3" or redefined == "4");
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+(define square (lambda (x) (* x x)))
+(define make-counter (lambda (start) (lambda (n) (+ start n))))
+(define from-ten (make-counter 10))
+(define shared (quote (1 2 3)))
+(define tail (cdr shared))
+(define big 123456789012345678901234567890)
+(define half (/ 1 2))
+(define pi 3.25)
+(define v (f64vector 1.0 2.0 3.0))
+(define w (i64vector 1 2 3))
+(define sym (quote hello))
+(define-memo cube (lambda (x) (* x x x)))
+(define successor (memoize (lambda (x) (+ x 1)) 2))
+(define twice (memoize successor 1))
+(define pruned (lambda (x) (if true (square x) 0)))
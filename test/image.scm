@@ -0,0 +1,29 @@
+(square 12)
+(from-ten 5)
+((make-counter 100) 1)
+shared
+tail
+(eq tail (cdr shared))
+(+ big 1)
+(+ half half)
+pi
+(vector-sum v)
+(vector-dot w w)
+sym
+(fib 10)
+pruned
+(pruned 3)
+(cube 3)
+(cube 3)
+(memo-stats cube)
+(successor 1)
+(successor 2)
+(successor 3)
+(successor 1)
+(memo-stats successor)
+(twice 5)
+(twice 5)
+(memo-stats twice)
+(memoize square 1.5)
+(define square (lambda (x) (+ x x)))
+(square 12)
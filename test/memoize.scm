@@ -0,0 +1,18 @@
+(define m (memoize (lambda (x) (lambda () x)) 2))
+(m m)
+(memo-stats m)
+(eq (m m) (m m))
+(m 1)
+(m 2)
+(memo-stats m)
+(m m)
+(memo-stats m)
+(define m 0)
+(gc)
+(gc)
+(define-memo fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 80)
+(memo-stats fib)
+(gc)
+(memoize fib 0)
+(memoize 1)
@@ -0,0 +1,25 @@
+(+ 9223372036854775807 1)
+(- -9223372036854775808 1)
+(* 4294967296 4294967296)
+(- (+ 9223372036854775807 1) 1)
+(/ 1 3)
+(+ (/ 1 3) (/ 2 3))
+(* (/ 2 3) 3/2)
+(/ 6 3)
+(+ 1/2 0.5)
+(= 9007199254740993 9007199254740992.0)
+(< 9007199254740992.0 9007199254740993)
+(= 9007199254740992 9007199254740992.0)
+(= 1/3 0.3333333333333333)
+(< 1/3 0.3333333333333333)
+(> 1/3 0.3333333333333333)
+(< 100000000000000000000000 1e23)
+(= 1 1.0)
+(< 2 2.5)
+1e400
+-1e400
+1e-400
+(< 123456789012345678901234567890 1e400)
+(> 123456789012345678901234567890 -1e400)
+(< (- 0 1e400) -123456789012345678901234567890)
+(= 1e400 1e400)
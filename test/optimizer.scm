@@ -0,0 +1,11 @@
+(define add1 (lambda (x) (+ x 1)))
+(define use (lambda (y) (if true (add1 (* 2 3)) y)))
+use
+(use 0)
+(define outer (lambda (a) (lambda (b) (cond (false 0) (true (add1 (+ a b)))))))
+outer
+(outer 1)
+((outer 1) 2)
+(define add1 (lambda (x) (- x 1)))
+((outer 1) 2)
+(use 0)
@@ -0,0 +1,32 @@
+(vector-sum (make-i64vector 2305843009213693953))
+(make-f64vector 2305843009213693952 1.0)
+(make-i64vector 9223372036854775807 0)
+(make-f64vector -1)
+(make-f64vector 0)
+(vector-sum (make-i64vector 5 3))
+(vector-length (make-f64vector 17 0.5))
+(vector-sum (make-f64vector 17 0.5))
+(+ (f64vector 1 2 3) (f64vector 0.5 0.5 0.5))
+(- (i64vector 1 2 3) (i64vector 3 2 1))
+(* (f64vector 1 2 3) (f64vector 2 2 2))
+(/ (f64vector 1 2 3) (f64vector 2 4 8))
+(vector-sum (+ (make-i64vector 17 1) (make-i64vector 17 2)))
+(vector-sum (- (make-i64vector 17 1) (make-i64vector 17 2)))
+(vector-sum (* (make-f64vector 17 2.0) (make-f64vector 17 3.0)))
+(vector-sum (/ (make-f64vector 17 1.0) (make-f64vector 17 4.0)))
+(+ (f64vector 1 2 3) (f64vector 1 2))
+(* (i64vector 1 2 3) (make-i64vector 17 1))
+(* (i64vector 4611686018427387904 3 -4611686018427387905) (i64vector 2 5 2))
+(+ (i64vector 9223372036854775807) (i64vector 1))
+(/ (i64vector 1 2) (i64vector 1 2))
+(/ (i64vector 1 2 3) (i64vector 1 2 3))
+(= (make-i64vector 17 5) (make-i64vector 17 5))
+(= (make-i64vector 17 5) (i64vector 5 5 5 5 5 5 5 5 5 5 5 5 5 5 5 5 6))
+(< (f64vector 1 2 3) (f64vector 2 3 4))
+(< (f64vector 1 2 3) (f64vector 2 3 3))
+(<= (f64vector 1 2 3) (f64vector 1 2 3))
+(<= (i64vector 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17) (i64vector 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 16))
+(> (make-f64vector 17 1.0) (make-f64vector 17 0.5))
+(> (i64vector 2 2 2) (i64vector 1 1 2))
+(>= (i64vector 2 2 2) (i64vector 1 2 2))
+(= (f64vector 1 2) (f64vector 1 2 3))
@@ -0,0 +1,8 @@
+(+ 1 2))
+(+ 3 4)
+)
+) ) (quote a)
+(quote
+  (multi
+   line))
+(quote (a (b c
\ No newline at end of file
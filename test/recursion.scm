@@ -0,0 +1,8 @@
+(define deep (lambda (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))
+(deep 5000)
+(define runaway (lambda (n) (+ 1 (runaway n))))
+(runaway 0)
+(pmap runaway (quote (0 1)))
+(deep 3)
+(define loop (lambda (n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1)))))
+(loop 1000000 0)
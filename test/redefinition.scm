@@ -0,0 +1,19 @@
+(define f (lambda (x) (+ x 1)))
+(define g (lambda (x) (f (f x))))
+(g 1)
+(g 1)
+(define f (lambda (x) (* x 10)))
+(g 1)
+(define h (lambda (n acc) (if (= n 0) acc (h (- n 1) (f acc)))))
+(h 3 1)
+(define f (lambda (x) (- x 1)))
+(h 3 1)
+(define k 5)
+(define read-k (lambda () k))
+(read-k)
+(define k (quote changed))
+(read-k)
+(define car (lambda (x) (quote shadowed)))
+(car (quote (1 2)))
+(define use-car (lambda (e) (car e)))
+(use-car (quote (1 2)))
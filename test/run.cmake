@@ -0,0 +1,47 @@
+# SCRIPT を sample の対話ループに流し込み、出力を SCRIPT と同名の .expected と比べる。
+# 実行時間と端末の色付けは取り除いてから比べる。PRELUDE があればそれを評価したイメージを
+# 先に保存し、そのイメージから開始する
+#
+#   cmake -DSAMPLE=<sample> -DSCRIPT=<x.scm> [-DENGINE=tree|vm] [-DOPTIMIZE=--optimize] [-DPRELUDE=<y.scm> -DIMAGE=<path>] -P run.cmake
+
+set(OPTIONS --engine=${ENGINE})
+
+if(OPTIMIZE)
+  list(APPEND OPTIONS ${OPTIMIZE})
+endif()
+
+if(PRELUDE)
+  execute_process(
+    COMMAND ${SAMPLE} ${OPTIONS} ${PRELUDE} --save-image=${IMAGE}
+    INPUT_FILE /dev/null
+    OUTPUT_QUIET
+    RESULT_VARIABLE RESULT)
+
+  if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "saving ${IMAGE} failed: ${RESULT}")
+  endif()
+
+  list(APPEND OPTIONS --image=${IMAGE})
+endif()
+
+execute_process(
+  COMMAND ${SAMPLE} ${OPTIONS}
+  INPUT_FILE ${SCRIPT}
+  OUTPUT_VARIABLE OUTPUT
+  ERROR_VARIABLE OUTPUT
+  RESULT_VARIABLE RESULT)
+
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "${SAMPLE} ${OPTIONS} < ${SCRIPT} exited with ${RESULT}\n${OUTPUT}")
+endif()
+
+string(REGEX REPLACE " in [0-9]+msec" "" OUTPUT "${OUTPUT}")
+string(ASCII 27 ESCAPE)
+string(REGEX REPLACE "${ESCAPE}\\[[0-9;]*m" "" OUTPUT "${OUTPUT}")
+
+string(REGEX REPLACE "\\.scm$" ".expected" EXPECTED ${SCRIPT})
+file(READ ${EXPECTED} EXPECTED_OUTPUT)
+
+if(NOT OUTPUT STREQUAL EXPECTED_OUTPUT)
+  message(FATAL_ERROR "output of ${OPTIONS} differs from ${EXPECTED}:\n${OUTPUT}")
+endif()
@@ -0,0 +1,176 @@
+// sample --listen の長さ付きの要求と応答。エラーになった要求もその要求の応答として返り、
+// 端末用の装飾を含まず、状態が失敗になり、サーバは続けて次の要求を処理すること
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+void write_all(int fd, const std::string& bytes)
+{
+  for (std::size_t offset {0}; offset < std::size(bytes); )
+  {
+    if (const auto n {::write(fd, std::data(bytes) + offset, std::size(bytes) - offset)}; 0 < n)
+    {
+      offset += n;
+    }
+    else throw std::runtime_error {"write"};
+  }
+}
+
+auto read_all(int fd, std::size_t size)
+{
+  std::string result(size, '\0');
+
+  for (std::size_t offset {0}; offset < size; )
+  {
+    if (const auto n {::read(fd, std::data(result) + offset, size - offset)}; 0 < n)
+    {
+      offset += n;
+    }
+    else throw std::runtime_error {"read"};
+  }
+
+  return result;
+}
+
+auto decode(const std::string& bytes)
+{
+  std::uint64_t result {0};
+
+  for (const auto each : bytes)
+  {
+    result = result << 8 | static_cast<unsigned char>(each);
+  }
+
+  return result;
+}
+
+auto frame(const std::string& body)
+{
+  std::string result {};
+
+  for (auto shift {32}; 0 < shift; shift -= 8)
+  {
+    result.push_back(static_cast<char>(std::size(body) >> (shift - 8)));
+  }
+
+  return result + body;
+}
+
+// 状態と本体
+auto response(int fd)
+{
+  const auto size {decode(read_all(fd, 4))};
+  const auto status {decode(read_all(fd, 1))};
+  read_all(fd, 8); // 実行時間
+  return std::make_pair(status, read_all(fd, size));
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: " << argv[0] << " <sample>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const auto path {"/tmp/corelisp_test_server." + std::to_string(::getpid())};
+
+  const auto pid {::fork()};
+
+  if (pid == 0)
+  {
+    const auto option {"--listen=" + path};
+    ::execl(argv[1], argv[1], option.c_str(), static_cast<char*>(nullptr));
+    std::_Exit(127);
+  }
+
+  ::sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+  const auto fd {::socket(AF_UNIX, SOCK_STREAM, 0)};
+
+  for (auto retry {0}; ::connect(fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0; ++retry)
+  {
+    if (100 < retry)
+    {
+      std::cerr << "failed to connect to " << path << std::endl;
+      ::kill(pid, SIGKILL);
+      return EXIT_FAILURE;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds {50});
+  }
+
+  constexpr std::uint64_t success {0}, failure {1};
+
+  // 要求と、応答の状態、本体の先頭と末尾
+  const std::vector<std::tuple<std::string, std::uint64_t, std::string, std::string>> cases
+  {
+    {"(+ 1 2)", success, "3\n", ""},
+    {")", failure, "(error: ", ")\n"},
+    {"(car 1)", failure, "(error: ", ")\n"},
+    {"(define x 10) ) (+ x 1)", failure, "10\n(error: ", ")\n11\n"},
+    {"(+ x 1)", success, "11\n", ""},
+    {"(quote (error: x))", success, "(error: x)\n", ""}, // 失敗と同じように表示される値
+    {"(+ x", failure, "(error: ", ")\n"},
+    {"(* 1/2 4) (quote done)", success, "2\ndone\n", ""},
+  };
+
+  int result {EXIT_SUCCESS};
+
+  try
+  {
+    std::string requests {};
+
+    for (const auto& each : cases) // 応答を待たずに続けて送る
+    {
+      requests += frame(std::get<0>(each));
+    }
+
+    write_all(fd, requests);
+
+    for (const auto& [request, status, prefix, suffix] : cases)
+    {
+      const auto [actual_status, actual] {response(fd)};
+
+      const auto matched {std::size(prefix) + std::size(suffix) <= std::size(actual) and actual.compare(0, std::size(prefix), prefix) == 0 and actual.compare(std::size(actual) - std::size(suffix), std::size(suffix), suffix) == 0};
+
+      if (not matched or actual_status != status or actual.find('\e') != std::string::npos or actual.find("->") != std::string::npos)
+      {
+        std::cerr << request << ": unexpected response " << actual_status << " \"" << actual << "\"" << std::endl;
+        result = EXIT_FAILURE;
+      }
+    }
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << "connection lost: " << ex.what() << std::endl;
+    result = EXIT_FAILURE;
+  }
+
+  ::close(fd);
+  ::kill(pid, SIGTERM);
+
+  if (int status {}; ::waitpid(pid, &status, 0) != pid or not WIFEXITED(status) or WEXITSTATUS(status) != EXIT_SUCCESS)
+  {
+    std::cerr << "server did not exit cleanly" << std::endl;
+    result = EXIT_FAILURE;
+  }
+
+  return result;
+}
@@ -0,0 +1,79 @@
+// parallel_for の呼び出し側は、盗める仕事がなくなったら回り続けずに眠ること。
+// 入れ子の呼び出しと例外の伝搬が変わらないこと
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <corelisp/utility/thread_pool.hpp>
+
+auto thread_cpu_time()
+  -> std::chrono::nanoseconds
+{
+  timespec ts {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds {ts.tv_sec} + std::chrono::nanoseconds {ts.tv_nsec};
+}
+
+#define CHECK(...)                                                             \
+  if (not (__VA_ARGS__))                                                       \
+  {                                                                            \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #__VA_ARGS__ << std::endl; \
+    return EXIT_FAILURE;                                                       \
+  }
+
+int main()
+{
+  utility::thread_pool pool {2};
+
+  {
+    const auto begin {thread_cpu_time()};
+
+    pool.parallel_for(2, [](std::size_t index)
+    {
+      if (index)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds {300});
+      }
+    });
+
+    const auto spent {thread_cpu_time() - begin};
+    std::cout << "waiting caller used " << std::chrono::duration_cast<std::chrono::milliseconds>(spent).count() << "msec of cpu" << std::endl;
+    CHECK(spent < std::chrono::milliseconds {100});
+  }
+
+  {
+    std::atomic<std::size_t> sum {0};
+
+    pool.parallel_for(8, [&](std::size_t i)
+    {
+      pool.parallel_for(8, [&](std::size_t j)
+      {
+        sum += i * 8 + j;
+      });
+    });
+
+    CHECK(sum == 63 * 64 / 2);
+  }
+
+  try
+  {
+    pool.parallel_for(4, [](std::size_t index)
+    {
+      if (index == 3)
+      {
+        throw std::runtime_error {"expected"};
+      }
+    });
+
+    CHECK(false);
+  }
+  catch (const std::runtime_error&)
+  {}
+
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,7 @@
 (define else true)
 
 (define null? (lambda (x)
-  (eq x (quote ())
+  (eq x (quote ()))
 ))
 
 (define and (lambda (lhs rhs)